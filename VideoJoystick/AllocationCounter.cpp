@@ -0,0 +1,72 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include "AllocationCounter.h"
+
+
+#ifdef VJ_COUNT_ALLOCATIONS
+
+static std::atomic<uint64_t> processAllocations(0);
+static thread_local uint64_t threadAllocations = 0;
+
+
+/// <summary>
+/// Our replacement for the global allocator; counts, then just does what the
+/// default one does
+/// </summary>
+static void *countedAllocate(size_t size)
+{
+   ++processAllocations;
+   ++threadAllocations;
+   return malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(size_t size)
+{
+   void *result = countedAllocate(size);
+   if (result == nullptr)
+      throw std::bad_alloc();
+   return result;
+}
+
+void *operator new[](size_t size)
+{
+   void *result = countedAllocate(size);
+   if (result == nullptr)
+      throw std::bad_alloc();
+   return result;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+   return countedAllocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+   return countedAllocate(size);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+
+bool AllocationCounter::isEnabled() { return true; }
+uint64_t AllocationCounter::getProcessAllocations() { return processAllocations; }
+uint64_t AllocationCounter::getThreadAllocations() { return threadAllocations; }
+
+#else
+
+bool AllocationCounter::isEnabled() { return false; }
+uint64_t AllocationCounter::getProcessAllocations() { return 0; }
+uint64_t AllocationCounter::getThreadAllocations() { return 0; }
+
+#endif
@@ -0,0 +1,30 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <stdint.h>
+
+
+/// <summary>
+/// Debug support for proving that our per-frame code doesn't touch the heap.
+/// When built with VJ_COUNT_ALLOCATIONS defined we replace the global
+/// operator new with one that counts; otherwise everything reports zero.
+/// </summary>
+class AllocationCounter final {
+public:
+   static bool isEnabled();
+   static uint64_t getProcessAllocations();
+   static uint64_t getThreadAllocations();
+
+private:
+   AllocationCounter() = delete;
+   ~AllocationCounter() = delete;
+};
+
+
+#endif
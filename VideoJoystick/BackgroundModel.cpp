@@ -0,0 +1,85 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <algorithm>
+#include "BackgroundModel.h"
+
+
+/// <summary>
+/// Initializes a new instance of class BackgroundModel for frames up to the
+/// given size, with nothing in the background
+/// </summary>
+BackgroundModel::BackgroundModel(int width, int height)
+   : detector(width, height)
+{
+   this->width = width;
+   this->height = height;
+   plane.reset(new uint8_t[width * height]);
+   targets.reset(new uint8_t[width * getBandRows(height)]);
+   reset();
+}
+
+
+/// <summary>
+/// Forgets everything in the background
+/// </summary>
+void BackgroundModel::reset()
+{
+   std::fill(plane.get(), plane.get() + width * height, 0);
+   nextRow = 0;
+}
+
+
+/// <summary>
+/// Refreshes the next band of rows from the frame.  The detector is set up
+/// the same as the ones we're going to be filtering so that the weights mean
+/// the same thing.
+/// </summary>
+void BackgroundModel::update(const VideoFrame &frame, bool lumaCheck, const ColorTable *colorTable)
+{
+   const FrameFormat &format = frame.getFormat();
+   int rows = std::min(format.height, height);
+   int columns = std::min(format.width, width);
+   if (rows <= 0 || columns <= 0)
+      return;
+
+   // bands are an even number of rows starting on an even row, so that they
+   // don't split the 2x2 blocks of subsampled formats
+   if (nextRow >= rows)
+      nextRow = 0;
+   ScanWindow band(0, nextRow, columns, std::min(nextRow + getBandRows(rows), rows));
+   nextRow = band.bottom;
+
+   detector.setLumaCheck(lumaCheck);
+   detector.setColorTable(colorTable);
+   detector.scan(format, frame.getPixelData(), frame.getPixelDataLength(), band);
+
+   // the band's targets; if the hit list overflowed we only have the first
+   // of them, which will do until next time
+   uint8_t *bandTargets = targets.get();
+   std::fill(bandTargets, bandTargets + width * (band.bottom - band.top), 0);
+   const uint16_t *hitX = detector.getHitX();
+   const uint16_t *hitY = detector.getHitY();
+   const uint8_t *hitWeight = detector.getHitWeight();
+   for (uint32_t i=0; i<detector.getHitsListed(); ++i)
+      bandTargets[width * (hitY[i] - band.top) + hitX[i]] = (uint8_t)std::min(hitWeight[i] + Margin, 255);
+
+   // and move toward them; this is simple enough for the compiler to
+   // vectorize
+   for (int y=band.top; y<band.bottom; ++y)
+   {
+      uint8_t *row = &plane[width * y];
+      const uint8_t *rowTargets = &bandTargets[width * (y - band.top)];
+      for (int x=0; x<columns; ++x)
+      {
+         int background = row[x];
+         int target = rowTargets[x];
+         int risen = std::min(background + Rise, target);
+         int fallen = std::max(background - Decay, target);
+         row[x] = (uint8_t)((target > background) ? risen : fallen);
+      }
+   }
+}
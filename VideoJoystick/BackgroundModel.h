@@ -0,0 +1,72 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef BACKGROUNDMODEL_H
+#define BACKGROUNDMODEL_H
+
+#include <stdint.h>
+#include <memory>
+#include "ColorTable.h"
+#include "DotDetector.h"
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// Remembers the things in view that look like the dot but never go
+/// anywhere, such as cabinet art or indicator lights, so that a DotDetector
+/// can ignore them.
+///
+/// The model is a plane of one byte per pixel: the weight a hit there has to
+/// beat, in the same units as the detector's hit weights.  Each refresh moves
+/// a pixel toward its target, which is its latest hit weight plus Margin, or
+/// zero if it isn't a hit; it rises by up to Rise and falls by up to Decay.
+/// Something that stays put therefore works its way into the model over a
+/// few seconds, and a blinking light stays there since it falls more
+/// slowly than it rises, but the dot only passes through any one pixel on
+/// its way somewhere else.  The flip side is that a dot that holds still
+/// for long enough becomes background too.
+///
+/// Updating is spread across frames: each frame refreshes the next band of
+/// rows, 1/UpdateFrames of the frame, by scanning just that band with a
+/// detector of our own, which costs about that fraction of a full scan.
+/// </summary>
+class BackgroundModel final
+{
+public:
+   // how many frames it takes to refresh the whole model
+   static constexpr int UpdateFrames = 16;
+
+   // how much a hit has to beat the background by, and how far the
+   // background moves toward its target per refresh
+   static constexpr int Margin = 32;
+   static constexpr int Rise = 8;
+   static constexpr int Decay = 4;
+
+public:
+   BackgroundModel(int width, int height);
+
+   void reset();
+   void update(const VideoFrame &frame, bool lumaCheck, const ColorTable *colorTable);
+
+   const uint8_t *getPlane() const { return plane.get(); }
+   int getStride() const { return width; }
+
+private:
+   int getBandRows(int rows) const { return ((rows + UpdateFrames - 1) / UpdateFrames + 1) & ~1; }
+
+private:
+   int width;
+   int height;
+   std::unique_ptr<uint8_t[]> plane;
+   DotDetector detector;
+   int nextRow = 0;
+
+   // the targets of the band being refreshed
+   std::unique_ptr<uint8_t[]> targets;
+};
+
+
+#endif
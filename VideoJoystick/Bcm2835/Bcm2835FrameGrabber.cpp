@@ -5,6 +5,7 @@
 #include "interface/mmal/util/mmal_util.h"
 #include "interface/mmal/util/mmal_util_params.h"
 #include "Bcm2835FrameGrabber.h"
+#include "Statistics.h"
 
 /// Video render needs at least 2 buffers.
 #define VIDEO_OUTPUT_BUFFERS_NUM 3
@@ -12,12 +13,16 @@
 
 static void camera_control_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer);
 static void check_disable_port(MMAL_PORT_T *port);
+static PixelFormat getPixelFormat(MMAL_FOURCC_T encoding, bool rgbOrderFixed);
 
 
 /// <summary>
-/// Initializes a new instance of class Bcm2835FrameGrabber
+/// Initializes a new instance of class Bcm2835FrameGrabber.  The dispatch
+/// settings say how frames get from MMAL's callback thread to the frame
+/// callback; with more than one processing thread it gets called
+/// concurrently for consecutive frames.
 /// </summary>
-Bcm2835FrameGrabber::Bcm2835FrameGrabber()
+Bcm2835FrameGrabber::Bcm2835FrameGrabber(const FrameDispatcher::Settings &dispatchSettings)
 {
    // initialize the libbcm2835 library if it hasn't been
    bcm2835 = LibBcm2835::Initialize();
@@ -28,6 +33,18 @@ Bcm2835FrameGrabber::Bcm2835FrameGrabber()
 
 	// create
 	CreateCameraComponent();
+
+	// frames that the processing threads can't keep up with go straight
+	// back to the camera
+	frameDispatcher.reset(new FrameDispatcher(
+		dispatchSettings,
+		[this](int slot, uint64_t sequence) { ProcessFrame(slot, sequence); },
+		[this](int slot)
+		{
+			Statistics::getInstance()->increment(Statistic::FramesDisplaced);
+			OnFrameReturned(slot);
+		}
+		));
 }
 
 
@@ -36,6 +53,13 @@ Bcm2835FrameGrabber::Bcm2835FrameGrabber()
 /// </summary>
 Bcm2835FrameGrabber::~Bcm2835FrameGrabber()
 {
+   // stop processing; from here on buffers just go back to the pool
+   terminated = true;
+   if (frameDispatcher)
+      frameDispatcher->stop();
+   if (framePool.getFramesLent() > 0)
+      vcos_log_error("Bcm2835FrameGrabber: frames still held at shutdown");
+
    check_disable_port(GetVideoPort());
 	DisableCamera();
 	DestroyCameraComponent();
@@ -88,37 +112,92 @@ void Bcm2835FrameGrabber::CameraBufferCallbackEntry(MMAL_PORT_T *port, MMAL_BUFF
 
 
 /// <summary>
-/// Processes the camera buffer
+/// Called on MMAL's thread with each buffer the camera fills; all we do is
+/// pass it on to our processing threads
 /// </summary>
 void Bcm2835FrameGrabber::CameraBufferCallback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
 {
-	// create a VideoFrame from the buffer; this way the frame handler can do whatever
-	// it wants, including processing it later on a different thread if it so desires
-	std::shared_ptr<VideoFrame> frame;
-	// lock the buffer, copy it, unlock
+	// MMAL's pts are by the GPU's clock, which we can't compare with ours, so
+	// the closest we can get to when the frame was exposed is now; nor does
+	// it number frames, so we count them as they arrive
+	uint64_t timestamp = VideoFrame::getCurrentTimestamp();
+	uint64_t cameraSequence = buffersReceived++;
+	Statistics::getInstance()->increment(Statistic::FramesCompleted);
+
+	// find the frame that goes with the buffer
+	int slot = -1;
+	for (int i=0; i<framePool.getCapacity(); ++i)
+		if (((MmalVideoFrame &)framePool.getFrame(i)).getBuffer() == buffer)
+			slot = i;
+
+	// if we're shutting down, or it's something we don't know about, it goes
+	// straight back
+	if (terminated || slot < 0)
+	{
+		mmal_buffer_header_release(buffer);
+		SendBufferToCamera();
+		return;
+	}
+
+	// it stays locked until the last reference to its frame goes away
 	mmal_buffer_header_mem_lock(buffer);
-	frame.reset(new VectorVideoFrame(buffer->data, buffer->length));
-	mmal_buffer_header_mem_unlock(buffer);
+	VideoFrame &pooledFrame = framePool.getFrame(slot);
+	pooledFrame.setCameraSequence(cameraSequence);
+	pooledFrame.setTimestamp(timestamp);
+	pooledFrame.setCompletionTimestamp(timestamp);
+	frameDispatcher->post(slot);
+}
 
-	// pass the buffer to the frame handler
-	frameCallback(frame);
 
-	// release buffer back to the pool
+/// <summary>
+/// Processes the frame in the given slot; called on one of the dispatcher's
+/// threads
+/// </summary>
+void Bcm2835FrameGrabber::ProcessFrame(int slot, uint64_t sequence)
+{
+	VideoFrame &pooledFrame = framePool.getFrame(slot);
+	pooledFrame.setSequence(sequence);
+	pooledFrame.setHandoffTimestamp(VideoFrame::getCurrentTimestamp());
+
+	// lend the frame to the callback; the buffer goes back to the camera when
+	// the last reference to the frame is released
+	std::shared_ptr<VideoFrame> frame = framePool.lend(slot);
+	Statistics::getInstance()->increment(Statistic::FramesProcessed);
+	if (frameCallback)
+		frameCallback(frame);
+}
+
+
+/// <summary>
+/// Called when the last reference to a frame we lent out goes away, on
+/// whatever thread released it; releases its buffer back to camera_pool and
+/// gives the camera one to fill
+/// </summary>
+void Bcm2835FrameGrabber::OnFrameReturned(int slot)
+{
+	MMAL_BUFFER_HEADER_T *buffer = ((MmalVideoFrame &)framePool.getFrame(slot)).getBuffer();
+	mmal_buffer_header_mem_unlock(buffer);
 	mmal_buffer_header_release(buffer);
+	SendBufferToCamera();
+}
 
-	// and send one back to the port (if still open)
-	if (port->is_enabled)
-	{
-	  MMAL_STATUS_T status;
 
-	  MMAL_BUFFER_HEADER_T *new_buffer = mmal_queue_get(camera_pool->queue);
+/// <summary>
+/// Sends a buffer from camera_pool to the video port, if it's still open
+/// </summary>
+void Bcm2835FrameGrabber::SendBufferToCamera()
+{
+	MMAL_PORT_T *port = GetVideoPort();
+	if (terminated || !port->is_enabled)
+		return;
 
-	  if (new_buffer)
-		 status = mmal_port_send_buffer(port, new_buffer);
+	MMAL_STATUS_T status = MMAL_SUCCESS;
+	MMAL_BUFFER_HEADER_T *new_buffer = mmal_queue_get(camera_pool->queue);
+	if (new_buffer)
+		status = mmal_port_send_buffer(port, new_buffer);
 
-	  if (!new_buffer || status != MMAL_SUCCESS)
-		 vcos_log_error("Unable to return a buffer to the camera port");
-	}
+	if (!new_buffer || status != MMAL_SUCCESS)
+		vcos_log_error("Unable to return a buffer to the camera port");
 }
 
 /**
@@ -227,7 +306,10 @@ void Bcm2835FrameGrabber::CreateCameraComponent()
          mmal_port_parameter_set(video_port, &fps_range.hdr);
     }
 
-    format->encoding = mmal_util_rgb_order_fixed(still_port) ? MMAL_ENCODING_RGB24 : MMAL_ENCODING_BGR24;
+    // older firmware has the RGB24 and BGR24 labels swapped; either way this
+    // asks for red first in memory, the same as raspicam does
+    bool rgbOrderFixed = mmal_util_rgb_order_fixed(still_port);
+    format->encoding = rgbOrderFixed ? MMAL_ENCODING_RGB24 : MMAL_ENCODING_BGR24;
     format->encoding_variant = 0;  //Irrelevant when not in opaque mode
 
     format->es->video.width = VCOS_ALIGN_UP(width, 32);
@@ -243,6 +325,11 @@ void Bcm2835FrameGrabber::CreateCameraComponent()
     if (status != MMAL_SUCCESS)
        throw std::runtime_error("camera video format couldn't be set");
 
+    // the detector kernel goes by whatever encoding the port actually took,
+    // so that getting the byte order wrong can't turn us into a blue dot
+    // detector; rows are padded out to the aligned width
+    frameFormat = FrameFormat::create(getPixelFormat(video_port->format->encoding, rgbOrderFixed), width, height, 3 * VCOS_ALIGN_UP(width, 32));
+
     // Ensure there are enough buffers to avoid dropping frames
     if (video_port->buffer_num < VIDEO_OUTPUT_BUFFERS_NUM)
        video_port->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
@@ -294,6 +381,14 @@ void Bcm2835FrameGrabber::CreateCameraComponent()
 
     camera_pool = pool;
     camera_component = camera;
+
+    // wrap each of the pool's buffers in a frame
+    for (unsigned i=0; pool != nullptr && i<pool->headers_num; ++i)
+    {
+       std::unique_ptr<VideoFrame> frame(new MmalVideoFrame(pool->header[i]));
+       frame->setFormat(frameFormat);
+       framePool.addFrame(std::move(frame));
+    }
    }
    catch (...)
    {
@@ -382,3 +477,24 @@ static void check_disable_port(MMAL_PORT_T *port)
 	if (port && port->is_enabled)
 		mmal_port_disable(port);
 }
+
+
+/// <summary>
+/// Returns the pixel format of the given encoding, by which byte comes first
+/// in memory.  Firmware without the RGB order fix has the RGB24 and BGR24
+/// labels the wrong way round (see mmal_util_rgb_order_fixed), so on that
+/// firmware each means the other.
+///
+/// What's been confirmed on hardware is the libcamera path, whose RGB888
+/// frames come out blue first, as the original detector assumed.  This path
+/// goes by MMAL's documented behavior and hasn't been checked against a
+/// camera; if the dot is only found when it's blue, this is where to look.
+/// </summary>
+static PixelFormat getPixelFormat(MMAL_FOURCC_T encoding, bool rgbOrderFixed)
+{
+   if (encoding == MMAL_ENCODING_RGB24)
+      return rgbOrderFixed ? PixelFormat::RGB24 : PixelFormat::BGR24;
+   if (encoding == MMAL_ENCODING_BGR24)
+      return rgbOrderFixed ? PixelFormat::BGR24 : PixelFormat::RGB24;
+   throw std::runtime_error("camera video port came up in an encoding we don't handle");
+}
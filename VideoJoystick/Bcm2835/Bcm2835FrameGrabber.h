@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include "interface/mmal/mmal.h"
@@ -14,7 +15,10 @@ extern "C" {
 };
 
 #include "LibBcm2835.h"
+#include "FrameDispatcher.h"
 #include "FrameGrabber.h"
+#include "FramePool.h"
+#include "MmalVideoFrame.h"
 
 
 // Video format information
@@ -29,20 +33,36 @@ extern "C" {
 
 
 /// <summary>
-/// FrameGrabber whose implementation is based on libbcm2835
+/// FrameGrabber whose implementation is based on libbcm2835.  Frames are
+/// processed in place in the camera's buffers, on our own processing threads
+/// rather than MMAL's callback thread; a buffer goes back to the camera when
+/// everyone is done with its frame.
 /// </summary>
 class Bcm2835FrameGrabber : public FrameGrabber
 {
 public:
-	Bcm2835FrameGrabber();
+	Bcm2835FrameGrabber(const FrameDispatcher::Settings &dispatchSettings = FrameDispatcher::Settings());
 	virtual ~Bcm2835FrameGrabber();
 
 	void SetupFrameCallback(const std::function<void(const std::shared_ptr<VideoFrame> &)> &callback) override;
 	void startCapturing() override;
 
+	uint64_t getFramesProcessed() const override { return frameDispatcher->getFramesProcessed(); }
+	uint64_t getFramesDropped() const override { return frameDispatcher->getFramesDropped(); }
+	int getFramesHeld() const override { return framePool.getFramesLent(); }
+	int getMaxFramesHeld() const override { return framePool.getMaxFramesLent(); }
+	uint64_t getTimesPoolExhausted() const override { return framePool.getTimesExhausted(); }
+	std::string getQueuePolicy() const override { return FrameDispatcher::getPolicyName(frameDispatcher->getPolicy()); }
+	int getQueueDepth() const override { return frameDispatcher->getQueueDepth(); }
+	int getMaxQueueDepth() const override { return frameDispatcher->getMaxQueueDepth(); }
+	void resetMaxQueueDepth() override { frameDispatcher->resetMaxQueueDepth(); }
+
 private:
 	void CreateCameraComponent();
 	void CameraBufferCallback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer);
+	void ProcessFrame(int slot, uint64_t sequence);
+	void OnFrameReturned(int slot);
+	void SendBufferToCamera();
 	void DisableCamera();
 	void DestroyCameraComponent();
 	MMAL_PORT_T *GetVideoPort() { return camera_component->output[MMAL_CAMERA_VIDEO_PORT]; }
@@ -66,8 +86,16 @@ private:
    uint32_t width = 640;                          /// Requested width of image
    uint32_t height = 480;                         /// requested height of image
    int framerate = VIDEO_FRAME_RATE_NUM;                      /// Requested frame rate (fps)
+   FrameFormat frameFormat;                       /// Layout of the frames we deliver
    MMAL_COMPONENT_T *camera_component = nullptr;    /// Pointer to the camera component
    std::function<void(const std::shared_ptr<VideoFrame> &)> frameCallback;
+   uint64_t buffersReceived = 0;
+
+   // a frame for each buffer header in camera_pool, and the threads that
+   // process them
+   std::atomic<bool> terminated { false };
+   FramePool framePool { [this](int slot) { OnFrameReturned(slot); } };
+   std::unique_ptr<FrameDispatcher> frameDispatcher;
 };
 
 
@@ -0,0 +1,34 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef MMALVIDEOFRAME_H
+#define MMALVIDEOFRAME_H
+
+#include "interface/mmal/mmal.h"
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// VideoFrame that reads straight out of an MMAL buffer rather than a copy of
+/// it.  There's one of these for each buffer header in the camera's pool; it
+/// only has valid contents while its buffer is lent out by
+/// Bcm2835FrameGrabber, which keeps the buffer locked until then.
+/// </summary>
+class MmalVideoFrame : public VideoFrame {
+public:
+	MmalVideoFrame(MMAL_BUFFER_HEADER_T *_buffer) : buffer(_buffer) {}
+
+	MMAL_BUFFER_HEADER_T *getBuffer() const { return buffer; }
+
+	int getPixelDataLength() const override { return buffer->length; }
+	const uint8_t *getPixelData() const override { return buffer->data + buffer->offset; }
+
+private:
+	MMAL_BUFFER_HEADER_T *buffer;
+};
+
+
+#endif
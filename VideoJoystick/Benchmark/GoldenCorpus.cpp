@@ -0,0 +1,519 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CaptureFile.h"
+#include "FileFrameGrabber.h"
+#include "FrameHandler.h"
+
+
+// documentation break
+//
+// A corpus is a directory of capture files, as written by "VideoJoystick
+// --record", each with a labels file alongside it named after it with
+// ".labels" on the end.  A labels file has a line per frame that we know the
+// answer for, by the frame's camera sequence number:
+//
+//    # comments and blank lines are ignored
+//    1042 318.5 240.25
+//    1043 none
+//
+// Frames that aren't labelled are still run through the detector, so that
+// tracking sees them, but they aren't scored.  "--write-labels" labels every
+// capture that doesn't have labels yet using the plain full frame detector,
+// as a starting point for checking them by hand.
+//
+// The baseline is the report from a run we were happy with, in the same CSV
+// format as the one we print; "--update-baseline" writes it.
+//
+
+
+/// <summary>
+/// One way of running the detector; these are what get compared against the
+/// baseline
+/// </summary>
+struct DetectorConfig {
+   const char *name;
+   int stripeCount;     // zero for one per core
+   int windowSize;      // zero to always search the whole frame
+   bool lumaCheck;
+   FrameHandler::SearchMode searchMode;
+   int pyramidBlockSize;
+   FrameHandler::DotSelection dotSelection = FrameHandler::DotSelection::Median;
+};
+
+static const DetectorConfig detectorConfigs[] = {
+   { "full",         1, 0,  true,  FrameHandler::SearchMode::Dense,   0 },
+   { "full-noluma",  1, 0,  false, FrameHandler::SearchMode::Dense,   0 },
+   { "full-striped", 0, 0,  true,  FrameHandler::SearchMode::Dense,   0 },
+   { "tracking",     1, 96, true,  FrameHandler::SearchMode::Dense,   0 },
+   { "pyramid4",     1, 0,  true,  FrameHandler::SearchMode::Pyramid, 4 },
+   { "pyramid8",     1, 0,  true,  FrameHandler::SearchMode::Pyramid, 8 },
+   { "profile",      1, 0,  true,  FrameHandler::SearchMode::Profile, 0 },
+   { "blob-largest", 1, 0,  true,  FrameHandler::SearchMode::Dense,   0, FrameHandler::DotSelection::LargestBlob },
+   { "blob-closest", 1, 96, true,  FrameHandler::SearchMode::Dense,   0, FrameHandler::DotSelection::ClosestBlob }
+};
+
+
+/// <summary>
+/// Where the dot is in a frame, if it's there at all
+/// </summary>
+struct Label {
+   bool hasDot = false;
+   float x = 0;
+   float y = 0;
+};
+
+
+/// <summary>
+/// A capture file's frames, and what we know about them
+/// </summary>
+struct Capture {
+   std::filesystem::path path;
+   std::vector<std::shared_ptr<VideoFrame>> frames;
+   std::map<uint64_t, Label> labels;
+};
+
+
+/// <summary>
+/// How a detector config did over the whole corpus
+/// </summary>
+struct CorpusResult {
+   std::string config;
+   uint64_t frames = 0;          // labelled frames
+   uint64_t dotFrames = 0;       // labelled frames with a dot
+   double meanError = 0;         // pixels, over the dots we found
+   double maxError = 0;
+   double missRate = 0;          // of the frames with a dot
+   double falsePositiveRate = 0; // of the frames without one
+   double nsPerFrame = 0;        // over every frame, labelled or not
+};
+
+
+/// <summary>
+/// How far out a result can be before we call it a regression
+/// </summary>
+struct Tolerance {
+   double error = 0.05;          // pixels, or 10% if that's more
+   double rate = 0.005;          // absolute, for the miss and false positive rates
+   double speed = 0.15;          // fraction of the baseline time
+};
+
+
+/// <summary>
+/// Reads a capture file's frames into memory, or rather keeps them mapped
+/// </summary>
+static void loadFrames(Capture &capture)
+{
+   FileFrameGrabber frameGrabber(capture.path, FileFrameGrabber::Pacing::AsFastAsPossible);
+   capture.frames.reserve(frameGrabber.getFrameCount());
+   frameGrabber.SetupFrameCallback([&](const std::shared_ptr<VideoFrame> &frame) { capture.frames.push_back(frame); });
+   frameGrabber.startCapturing();
+   while (!frameGrabber.isFinished())
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+
+/// <summary>
+/// Reads a labels file; throws if there's something in it we don't understand
+/// </summary>
+static std::map<uint64_t, Label> readLabels(const std::filesystem::path &path)
+{
+   std::map<uint64_t, Label> labels;
+   std::ifstream in(path);
+   std::string line;
+   for (int lineNumber=1; std::getline(in, line); ++lineNumber)
+   {
+      auto hash = line.find('#');
+      if (hash != std::string::npos)
+         line.erase(hash);
+
+      std::istringstream fields(line);
+      uint64_t sequence;
+      std::string x;
+      if (!(fields >> sequence))
+      {
+         if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+         throw std::runtime_error(path.string() + ":" + std::to_string(lineNumber) + ": bad label");
+      }
+
+      Label label;
+      if (!(fields >> x))
+         throw std::runtime_error(path.string() + ":" + std::to_string(lineNumber) + ": bad label");
+      if (x != "none")
+      {
+         label.hasDot = true;
+         label.x = strtof(x.c_str(), nullptr);
+         if (!(fields >> label.y))
+            throw std::runtime_error(path.string() + ":" + std::to_string(lineNumber) + ": bad label");
+      }
+      labels[sequence] = label;
+   }
+   return labels;
+}
+
+
+static std::filesystem::path getLabelsPath(const std::filesystem::path &capturePath)
+{
+   return capturePath.string() + ".labels";
+}
+
+
+/// <summary>
+/// Runs the frames through the given config, returning what it said for
+/// each one and how long it took per frame
+/// </summary>
+static std::vector<Label> detect(const DetectorConfig &config, const std::vector<std::shared_ptr<VideoFrame>> &frames, double &nsPerFrame)
+{
+   std::vector<Label> results(frames.size());
+   Label *result = nullptr;
+
+   FrameHandler frameHandler(config.stripeCount);
+   frameHandler.setWarmupFrames(0);
+   frameHandler.setWindowSize(config.windowSize);
+   frameHandler.setLumaCheck(config.lumaCheck);
+   frameHandler.setSearchMode(config.searchMode);
+   frameHandler.setPyramidBlockSize(config.pyramidBlockSize);
+   frameHandler.setDotSelection(config.dotSelection);
+   frameHandler.setFrameNotify([&](float x, float y, const VideoFrame &) {
+      result->hasDot = true;
+      result->x = x;
+      result->y = y;
+   });
+
+   auto start = std::chrono::steady_clock::now();
+   for (size_t i=0; i<frames.size(); ++i)
+   {
+      result = &results[i];
+      frameHandler.HandleFrame(frames[i]);
+   }
+   std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+   nsPerFrame = frames.empty() ? 0 : elapsed.count() / frames.size();
+
+   return results;
+}
+
+
+/// <summary>
+/// Runs every capture through the given config and scores it.  The
+/// captures are run several times and we take the quickest, since anything
+/// else that's going on can only slow us down.
+/// </summary>
+static CorpusResult runConfig(const DetectorConfig &config, const std::vector<Capture> &captures, int passes, float hitRadius)
+{
+   CorpusResult result;
+   result.config = config.name;
+
+   uint64_t totalFrames = 0;
+   uint64_t hits = 0, misses = 0, falsePositives = 0;
+   double errorSum = 0;
+   for (const Capture &capture : captures)
+   {
+      double bestNsPerFrame = 0;
+      std::vector<Label> detected;
+      for (int pass=0; pass<passes; ++pass)
+      {
+         double nsPerFrame;
+         detected = detect(config, capture.frames, nsPerFrame);
+         if (pass == 0 || nsPerFrame < bestNsPerFrame)
+            bestNsPerFrame = nsPerFrame;
+      }
+      result.nsPerFrame += bestNsPerFrame * capture.frames.size();
+      totalFrames += capture.frames.size();
+
+      for (size_t i=0; i<capture.frames.size(); ++i)
+      {
+         auto label = capture.labels.find(capture.frames[i]->getCameraSequence());
+         if (label == capture.labels.end())
+            continue;
+
+         // finding the dot somewhere other than where it is counts as missing
+         // it
+         ++result.frames;
+         if (label->second.hasDot)
+         {
+            ++result.dotFrames;
+            float error = std::hypot(detected[i].x - label->second.x, detected[i].y - label->second.y);
+            if (detected[i].hasDot && error <= hitRadius)
+            {
+               ++hits;
+               errorSum += error;
+               result.maxError = std::max(result.maxError, (double)error);
+            }
+            else
+               ++misses;
+         }
+         else if (detected[i].hasDot)
+            ++falsePositives;
+      }
+   }
+
+   uint64_t noDotFrames = result.frames - result.dotFrames;
+   result.meanError = hits ? errorSum / hits : 0;
+   result.missRate = result.dotFrames ? (double)misses / result.dotFrames : 0;
+   result.falsePositiveRate = noDotFrames ? (double)falsePositives / noDotFrames : 0;
+   result.nsPerFrame = totalFrames ? result.nsPerFrame / totalFrames : 0;
+   return result;
+}
+
+
+static const char ReportHeader[] = "config,frames,dotFrames,meanError,maxError,missRate,falsePositiveRate,nsPerFrame";
+
+
+static void writeReport(std::ostream &out, const std::vector<CorpusResult> &results)
+{
+   out << ReportHeader << std::endl;
+   for (const CorpusResult &result : results)
+   {
+      out << result.config << ","
+         << result.frames << ","
+         << result.dotFrames << ","
+         << result.meanError << ","
+         << result.maxError << ","
+         << result.missRate << ","
+         << result.falsePositiveRate << ","
+         << result.nsPerFrame << std::endl;
+   }
+}
+
+
+static std::map<std::string, CorpusResult> readReport(const std::filesystem::path &path)
+{
+   std::map<std::string, CorpusResult> results;
+   std::ifstream in(path);
+   std::string line;
+   while (std::getline(in, line))
+   {
+      if (line.empty() || line == ReportHeader)
+         continue;
+
+      CorpusResult result;
+      std::replace(line.begin(), line.end(), ',', ' ');
+      std::istringstream fields(line);
+      if (fields >> result.config >> result.frames >> result.dotFrames >> result.meanError >> result.maxError
+            >> result.missRate >> result.falsePositiveRate >> result.nsPerFrame)
+         results[result.config] = result;
+   }
+   return results;
+}
+
+
+/// <summary>
+/// Compares a result with its baseline, saying what got worse; returns false
+/// if anything did
+/// </summary>
+static bool checkBaseline(const CorpusResult &result, const CorpusResult &baseline, const Tolerance &tolerance)
+{
+   bool ok = true;
+   auto check = [&](const char *what, double value, double limit) {
+      if (value > limit)
+      {
+         std::cout << "REGRESSION " << result.config << " " << what << ": " << value << ", limit " << limit << std::endl;
+         ok = false;
+      }
+   };
+
+   if (result.frames != baseline.frames || result.dotFrames != baseline.dotFrames)
+      std::cout << "warning: " << result.config << ": the corpus has changed since the baseline" << std::endl;
+
+   check("meanError", result.meanError, baseline.meanError + std::max(tolerance.error, 0.1 * baseline.meanError));
+   check("missRate", result.missRate, baseline.missRate + tolerance.rate);
+   check("falsePositiveRate", result.falsePositiveRate, baseline.falsePositiveRate + tolerance.rate);
+   check("nsPerFrame", result.nsPerFrame, baseline.nsPerFrame * (1 + tolerance.speed));
+   return ok;
+}
+
+
+/// <summary>
+/// Labels every capture in the corpus that isn't labelled yet with what the
+/// full frame detector makes of it
+/// </summary>
+static void writeLabels(const std::vector<std::filesystem::path> &capturePaths)
+{
+   for (const std::filesystem::path &path : capturePaths)
+   {
+      std::filesystem::path labelsPath = getLabelsPath(path);
+      if (std::filesystem::exists(labelsPath))
+         continue;
+
+      Capture capture;
+      capture.path = path;
+      loadFrames(capture);
+      double nsPerFrame;
+      std::vector<Label> detected = detect(detectorConfigs[0], capture.frames, nsPerFrame);
+
+      std::ofstream out(labelsPath);
+      out << "# written by GoldenCorpus --write-labels from the " << detectorConfigs[0].name << " detector; check before use" << std::endl;
+      for (size_t i=0; i<capture.frames.size(); ++i)
+      {
+         out << capture.frames[i]->getCameraSequence() << " ";
+         if (detected[i].hasDot)
+            out << detected[i].x << " " << detected[i].y << std::endl;
+         else
+            out << "none" << std::endl;
+      }
+      std::cerr << "wrote " << labelsPath.string() << std::endl;
+   }
+}
+
+
+/// <summary>
+/// Finds the capture files in the corpus directory, in name order so that
+/// runs are repeatable; anything that isn't one, like the labels and the
+/// baseline, is passed over
+/// </summary>
+static std::vector<std::filesystem::path> findCaptures(const std::filesystem::path &directory)
+{
+   std::vector<std::filesystem::path> paths;
+   for (const auto &entry : std::filesystem::directory_iterator(directory))
+   {
+      if (!entry.is_regular_file())
+         continue;
+
+      CaptureFileHeader header;
+      std::ifstream in(entry.path(), std::ios::binary);
+      if (in.read((char *)&header, sizeof(header)) && header.isValid())
+         paths.push_back(entry.path());
+   }
+   std::sort(paths.begin(), paths.end());
+   return paths;
+}
+
+
+/// <summary>
+/// Runs every detector config over a corpus of labelled frames, reporting
+/// how accurate and how quick each one is, and fails if any of them has got
+/// worse than the baseline.
+///
+///   GoldenCorpus DIRECTORY [--baseline FILE] [--update-baseline]
+///      [--write-labels] [--passes N] [--hit-radius PIXELS]
+///      [--speed-tolerance FRACTION]
+///
+/// The baseline defaults to baseline.csv in the corpus directory.  Exits
+/// with 1 if anything regressed, 2 if we couldn't run at all.
+/// </summary>
+int main(int argc, const char **argv)
+{
+   std::filesystem::path directory;
+   std::filesystem::path baselinePath;
+   bool updateBaseline = false;
+   bool labelCaptures = false;
+   int passes = 3;
+   float hitRadius = 10;
+   Tolerance tolerance;
+   for (int i=1; i<argc; ++i)
+   {
+      if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+         baselinePath = argv[++i];
+      else if (strcmp(argv[i], "--update-baseline") == 0)
+         updateBaseline = true;
+      else if (strcmp(argv[i], "--write-labels") == 0)
+         labelCaptures = true;
+      else if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc)
+         passes = std::max(1, atoi(argv[++i]));
+      else if (strcmp(argv[i], "--hit-radius") == 0 && i + 1 < argc)
+         hitRadius = (float)atof(argv[++i]);
+      else if (strcmp(argv[i], "--speed-tolerance") == 0 && i + 1 < argc)
+         tolerance.speed = atof(argv[++i]);
+      else if (argv[i][0] != '-' && directory.empty())
+         directory = argv[i];
+      else
+      {
+         directory.clear();
+         break;
+      }
+   }
+   if (directory.empty())
+   {
+      std::cerr << "usage: GoldenCorpus DIRECTORY [--baseline FILE] [--update-baseline] [--write-labels]" << std::endl;
+      std::cerr << "          [--passes N] [--hit-radius PIXELS] [--speed-tolerance FRACTION]" << std::endl;
+      return 2;
+   }
+   if (baselinePath.empty())
+      baselinePath = directory / "baseline.csv";
+
+   try
+   {
+      std::vector<std::filesystem::path> capturePaths = findCaptures(directory);
+      if (labelCaptures)
+         writeLabels(capturePaths);
+
+      // only the labelled captures count
+      std::vector<Capture> captures;
+      for (const std::filesystem::path &path : capturePaths)
+      {
+         std::filesystem::path labelsPath = getLabelsPath(path);
+         if (!std::filesystem::exists(labelsPath))
+         {
+            std::cerr << "skipping " << path.string() << ": no labels" << std::endl;
+            continue;
+         }
+
+         Capture capture;
+         capture.path = path;
+         capture.labels = readLabels(labelsPath);
+         loadFrames(capture);
+         captures.push_back(std::move(capture));
+      }
+      if (captures.empty())
+      {
+         std::cerr << "GoldenCorpus: no labelled captures in " << directory.string() << std::endl;
+         return 2;
+      }
+
+      std::vector<CorpusResult> results;
+      for (const DetectorConfig &config : detectorConfigs)
+         results.push_back(runConfig(config, captures, passes, hitRadius));
+      writeReport(std::cout, results);
+
+      if (updateBaseline)
+      {
+         std::ofstream out(baselinePath);
+         writeReport(out, results);
+         if (!out)
+            throw std::runtime_error("can't write " + baselinePath.string());
+         std::cout << "baseline written to " << baselinePath.string() << std::endl;
+         return 0;
+      }
+
+      if (!std::filesystem::exists(baselinePath))
+      {
+         std::cout << "no baseline at " << baselinePath.string() << "; nothing to compare with" << std::endl;
+         return 0;
+      }
+
+      std::map<std::string, CorpusResult> baseline = readReport(baselinePath);
+      bool ok = true;
+      for (const CorpusResult &result : results)
+      {
+         auto baselineResult = baseline.find(result.config);
+         if (baselineResult == baseline.end())
+            std::cout << "warning: no baseline for " << result.config << std::endl;
+         else if (!checkBaseline(result, baselineResult->second, tolerance))
+            ok = false;
+      }
+      std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+      return ok ? 0 : 1;
+   }
+   catch (const std::exception &e)
+   {
+      std::cerr << "GoldenCorpus: " << e.what() << std::endl;
+      return 2;
+   }
+}
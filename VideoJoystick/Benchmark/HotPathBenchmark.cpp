@@ -0,0 +1,490 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BackgroundModel.h"
+#include "CommandProcessor.h"
+#include "FrameHandler.h"
+#include "SPIDAC.h"
+#include "SyntheticFrameGrabber.h"
+#include "VJConfig.h"
+#include "XYDriver.h"
+
+
+// keeps the compiler from optimizing away a result we never look at
+template <typename T> static void doNotOptimize(const T &value)
+{
+   asm volatile("" : : "r,m"(value) : "memory");
+}
+
+
+/// <summary>
+/// How long one operation of a benchmark took, over several batches
+/// </summary>
+struct BenchmarkResult {
+   std::string name;
+   uint64_t iterations = 0;
+   int batches = 0;
+   double minNs = 0;
+   double medianNs = 0;
+   double meanNs = 0;
+   double maxNs = 0;
+};
+
+
+/// <summary>
+/// Runs benchmarks and collects their results.  Each benchmark is given a
+/// number of iterations to do; we find out how many it takes to fill a batch
+/// of reasonable length, then time several batches and report the time per
+/// iteration.  The minimum is the one to compare between builds, the spread
+/// says how much to trust it.
+/// </summary>
+class BenchmarkRunner {
+public:
+   BenchmarkRunner(const std::string &filter, std::chrono::milliseconds batchTime, int batchCount)
+      : filter(filter), batchTime(batchTime), batchCount(batchCount) {}
+
+   void run(const std::string &name, const std::function<void(uint64_t iterations)> &body);
+   void writeJson(std::ostream &out) const;
+
+private:
+   static std::string escape(const std::string &s);
+
+private:
+   std::string filter;
+   std::chrono::milliseconds batchTime;
+   int batchCount;
+   std::vector<BenchmarkResult> results;
+};
+
+
+/// <summary>
+/// Runs the given benchmark if it passes the filter
+/// </summary>
+void BenchmarkRunner::run(const std::string &name, const std::function<void(uint64_t iterations)> &body)
+{
+   if (!filter.empty() && name.find(filter) == std::string::npos)
+      return;
+   std::cerr << name << "..." << std::flush;
+
+   auto time = [&](uint64_t iterations) {
+      auto start = std::chrono::steady_clock::now();
+      body(iterations);
+      return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+   };
+
+   // keep doubling until a batch takes long enough to time; that also gets
+   // the caches and branch predictors warmed up
+   uint64_t iterations = 1;
+   for (;;)
+   {
+      auto elapsed = time(iterations);
+      if (elapsed >= batchTime || iterations >= (1ull << 40))
+         break;
+      iterations *= 2;
+   }
+
+   std::vector<double> nsPerIteration;
+   for (int i=0; i<batchCount; ++i)
+      nsPerIteration.push_back(time(iterations).count() / iterations);
+   std::sort(nsPerIteration.begin(), nsPerIteration.end());
+
+   BenchmarkResult result;
+   result.name = name;
+   result.iterations = iterations;
+   result.batches = batchCount;
+   result.minNs = nsPerIteration.front();
+   result.medianNs = nsPerIteration[nsPerIteration.size() / 2];
+   result.maxNs = nsPerIteration.back();
+   for (double ns : nsPerIteration)
+      result.meanNs += ns / nsPerIteration.size();
+   results.push_back(result);
+
+   std::cerr << " " << result.medianNs << "ns" << std::endl;
+}
+
+
+/// <summary>
+/// Writes the results, and what they were measured on, as JSON
+/// </summary>
+void BenchmarkRunner::writeJson(std::ostream &out) const
+{
+   char hostName[256] = {};
+   gethostname(hostName, sizeof(hostName) - 1);
+   auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+
+   out << "{\n";
+   out << "  \"benchmark\": \"HotPathBenchmark\",\n";
+   out << "  \"host\": \"" << escape(hostName) << "\",\n";
+   out << "  \"time\": " << now.count() << ",\n";
+   out << "  \"compiler\": \"" << escape(__VERSION__) << "\",\n";
+#ifdef __OPTIMIZE__
+   out << "  \"optimized\": true,\n";
+#else
+   out << "  \"optimized\": false,\n";
+#endif
+   out << "  \"hardwareConcurrency\": " << std::thread::hardware_concurrency() << ",\n";
+   out << "  \"results\": [";
+   for (size_t i=0; i<results.size(); ++i)
+   {
+      const BenchmarkResult &result = results[i];
+      out << (i == 0 ? "\n" : ",\n");
+      out << "    { \"name\": \"" << escape(result.name) << "\""
+         << ", \"iterations\": " << result.iterations
+         << ", \"batches\": " << result.batches
+         << ", \"minNs\": " << result.minNs
+         << ", \"medianNs\": " << result.medianNs
+         << ", \"meanNs\": " << result.meanNs
+         << ", \"maxNs\": " << result.maxNs
+         << " }";
+   }
+   out << "\n  ]\n";
+   out << "}\n";
+}
+
+
+std::string BenchmarkRunner::escape(const std::string &s)
+{
+   std::string result;
+   for (char c : s)
+   {
+      if (c == '"' || c == '\\')
+         result += '\\';
+      if ((unsigned char)c >= ' ')
+         result += c;
+   }
+   return result;
+}
+
+
+/// <summary>
+/// Times FrameHandler::HandleFrame on frames of the given scene, with
+/// tracking either on or off and the given search mode and dot selection; the
+/// frame is rendered once and handed over again and again
+/// </summary>
+static void benchmarkHandleFrame(BenchmarkRunner &runner, const std::string &name, const SyntheticScene &scene, bool tracking,
+   FrameHandler::SearchMode searchMode = FrameHandler::SearchMode::Dense, int pyramidBlockSize = 8,
+   FrameHandler::DotSelection dotSelection = FrameHandler::DotSelection::Median)
+{
+   std::shared_ptr<VideoFrame> frame = SyntheticFrameGrabber(scene).renderFrame(0);
+
+   FrameHandler frameHandler(1);
+   frameHandler.setWarmupFrames(0);
+   if (!tracking)
+      frameHandler.setWindowSize(0);
+   std::string mode = tracking ? "/tracking" : "/acquiring";
+   frameHandler.setSearchMode(searchMode);
+   frameHandler.setPyramidBlockSize(pyramidBlockSize);
+   if (searchMode == FrameHandler::SearchMode::Pyramid)
+      mode += "-pyramid" + std::to_string(pyramidBlockSize);
+   else if (searchMode == FrameHandler::SearchMode::Profile)
+      mode += "-profile";
+   frameHandler.setDotSelection(dotSelection);
+   if (dotSelection != FrameHandler::DotSelection::Median)
+      mode += "-blobs";
+   uint64_t sequence = 0;
+   runner.run("FrameHandler.HandleFrame/" + name + mode, [&](uint64_t iterations) {
+      for (uint64_t i=0; i<iterations; ++i)
+      {
+         // keep the sequence numbers going up so that we don't look like
+         // we're missing frames
+         frame->setSequence(sequence);
+         frame->setCameraSequence(sequence);
+         ++sequence;
+         frameHandler.HandleFrame(frame);
+      }
+   });
+}
+
+
+static void benchmarkFrameHandler(BenchmarkRunner &runner)
+{
+   SyntheticScene scene;
+   scene.amplitudeX = 0;
+   scene.amplitudeY = 0;
+
+   // what the camera normally sees, in each format we can get it in
+   const std::pair<PixelFormat, const char *> formats[] = {
+      { PixelFormat::BGR24, "bgr24" },
+      { PixelFormat::XRGB8888, "xrgb8888" },
+      { PixelFormat::YUV420, "yuv420" },
+      { PixelFormat::BayerRGGB10, "bayer10" },
+      { PixelFormat::BayerRGGB10Packed, "bayer10packed" }
+   };
+   for (auto &format : formats)
+   {
+      scene.pixelFormat = format.first;
+      benchmarkHandleFrame(runner, std::string(format.second) + "-dot", scene, false);
+      benchmarkHandleFrame(runner, std::string(format.second) + "-dot", scene, true);
+   }
+
+   // the coarse to fine search, for the formats it handles
+   scene.pixelFormat = PixelFormat::BGR24;
+   benchmarkHandleFrame(runner, "bgr24-dot", scene, false, FrameHandler::SearchMode::Pyramid, 4);
+   benchmarkHandleFrame(runner, "bgr24-dot", scene, false, FrameHandler::SearchMode::Pyramid, 8);
+   scene.pixelFormat = PixelFormat::XRGB8888;
+   benchmarkHandleFrame(runner, "xrgb8888-dot", scene, false, FrameHandler::SearchMode::Pyramid, 8);
+
+   // and the profiles
+   scene.pixelFormat = PixelFormat::BGR24;
+   benchmarkHandleFrame(runner, "bgr24-dot", scene, false, FrameHandler::SearchMode::Profile);
+   scene.pixelFormat = PixelFormat::XRGB8888;
+   benchmarkHandleFrame(runner, "xrgb8888-dot", scene, false, FrameHandler::SearchMode::Profile);
+
+   // no dot at all, which is the most common case when acquiring
+   scene.pixelFormat = PixelFormat::BGR24;
+   scene.dotBrightness = 0;
+   benchmarkHandleFrame(runner, "bgr24-nodot", scene, false);
+
+   // things that look a bit like the dot, which make more work for the
+   // detector
+   scene.dotBrightness = 1;
+   for (int i=0; i<8; ++i)
+   {
+      SyntheticObject distractor;
+      distractor.x = 40.0f + 75 * i;
+      distractor.y = (i % 2) ? 100.0f : 380.0f;
+      scene.distractors.push_back(distractor);
+   }
+   benchmarkHandleFrame(runner, "bgr24-distractors", scene, false);
+   benchmarkHandleFrame(runner, "bgr24-distractors", scene, false, FrameHandler::SearchMode::Profile);
+   benchmarkHandleFrame(runner, "bgr24-distractors", scene, false, FrameHandler::SearchMode::Dense, 8, FrameHandler::DotSelection::LargestBlob);
+
+   // a frame that's red all over, so that every pixel is a hit; as bad as it
+   // gets
+   scene.distractors.clear();
+   scene.backgroundR = 220;
+   scene.backgroundG = 30;
+   scene.backgroundB = 30;
+   benchmarkHandleFrame(runner, "bgr24-allred", scene, false);
+   benchmarkHandleFrame(runner, "bgr24-allred", scene, false, FrameHandler::SearchMode::Profile);
+   benchmarkHandleFrame(runner, "bgr24-allred", scene, false, FrameHandler::SearchMode::Dense, 8, FrameHandler::DotSelection::LargestBlob);
+}
+
+
+static void benchmarkBackgroundModel(BenchmarkRunner &runner)
+{
+   // one band's refresh, which is what each frame pays with the model on
+   SyntheticScene scene;
+   for (int i=0; i<8; ++i)
+   {
+      SyntheticObject distractor;
+      distractor.x = 40.0f + 75 * i;
+      distractor.y = (i % 2) ? 100.0f : 380.0f;
+      scene.distractors.push_back(distractor);
+   }
+   const std::pair<PixelFormat, const char *> formats[] = {
+      { PixelFormat::BGR24, "bgr24" },
+      { PixelFormat::YUV420, "yuv420" }
+   };
+   for (auto &format : formats)
+   {
+      scene.pixelFormat = format.first;
+      std::shared_ptr<VideoFrame> frame = SyntheticFrameGrabber(scene).renderFrame(0);
+      BackgroundModel model(frame->getFormat().width, frame->getFormat().height);
+      runner.run(std::string("BackgroundModel.update/") + format.second, [&](uint64_t iterations) {
+         for (uint64_t i=0; i<iterations; ++i)
+            model.update(*frame, true, nullptr);
+      });
+   }
+}
+
+
+static void benchmarkXYDriver(BenchmarkRunner &runner)
+{
+   XYDriver xyDriver;
+   XYDriverConfig config;
+   config.xy00 = XY(20, 15);
+   config.xy01 = XY(25, 470);
+   config.xy10 = XY(630, 10);
+   config.xy11 = XY(620, 465);
+   xyDriver.setConfig(config);
+
+   // points all over the frame, so that both halves get used
+   std::vector<XY> points;
+   srand(42);
+   for (int i=0; i<1024; ++i)
+      points.push_back(XY((float)(rand() % 640), (float)(rand() % 480)));
+
+   runner.run("XYDriver.getXY", [&](uint64_t iterations) {
+      for (uint64_t i=0; i<iterations; ++i)
+         doNotOptimize(xyDriver.getXY(points[i & 1023]));
+   });
+
+   runner.run("XYDriver.decompose", [&](uint64_t iterations) {
+      float a, b;
+      for (uint64_t i=0; i<iterations; ++i)
+      {
+         XYDriver::decompose(points[i & 1023], config.xy01, config.xy11, &a, &b);
+         doNotOptimize(a);
+         doNotOptimize(b);
+      }
+   });
+}
+
+
+static void benchmarkSPIDAC(BenchmarkRunner &runner)
+{
+   // just building the packet; sending it takes the SPI hardware
+   runner.run("SPIDAC.encodeDacCommand", [&](uint64_t iterations) {
+      uint8_t packet[2];
+      float value = 0;
+      for (uint64_t i=0; i<iterations; ++i)
+      {
+         SPIDAC::encodeDacCommand(SPIDAC::DacCommand::LoadAAndUpdate, value, packet);
+         doNotOptimize(packet);
+         value += 0.001f;
+         if (value > 1.1f)
+            value = -0.1f;
+      }
+   });
+}
+
+
+static void benchmarkCommandProcessor(BenchmarkRunner &runner)
+{
+   // the same handlers as the real thing, near enough, so that the lookup
+   // has as many to get through
+   static const char *commands[] = {
+      "shutdown", "setX", "setY", "getImage", "getPixXY", "getSaturation",
+      "getFrameProcessTime", "getOutputLatency", "getLatency", "resetLatency",
+      "getAllocations", "resetAllocations", "getStripeCount", "getTrackingMode",
+      "getWindowSize", "setWindowSize", "getLossTimeout", "setLossTimeout",
+      "getLumaCheck", "setLumaCheck", "getTruthError", "getXY", "cal00",
+      "cal01", "cal10", "cal11", "getFrameCounts", "getStats", "getFramePool",
+      "getQueue", "resetQueue"
+   };
+   CommandProcessor commandProcessor;
+   for (const char *command : commands)
+      commandProcessor.AddHandler(command, [](const std::string &parameters) { return parameters.empty() ? "0.5,0.5" : parameters; });
+
+   runner.run("CommandProcessor.ProcessCommand/noparameters", [&](uint64_t iterations) {
+      for (uint64_t i=0; i<iterations; ++i)
+         doNotOptimize(commandProcessor.ProcessCommand("getXY"));
+   });
+   runner.run("CommandProcessor.ProcessCommand/parameters", [&](uint64_t iterations) {
+      for (uint64_t i=0; i<iterations; ++i)
+         doNotOptimize(commandProcessor.ProcessCommand("setWindowSize 128"));
+   });
+   runner.run("CommandProcessor.ProcessCommand/unknown", [&](uint64_t iterations) {
+      for (uint64_t i=0; i<iterations; ++i)
+         doNotOptimize(commandProcessor.ProcessCommand("bleem 42 7"));
+   });
+}
+
+
+static void benchmarkVideoFrame(BenchmarkRunner &runner)
+{
+   SyntheticScene scene;
+   const std::pair<PixelFormat, const char *> formats[] = {
+      { PixelFormat::BGR24, "bgr24" },
+      { PixelFormat::YUV420, "yuv420" }
+   };
+   for (auto &format : formats)
+   {
+      scene.pixelFormat = format.first;
+      std::shared_ptr<VideoFrame> frame = SyntheticFrameGrabber(scene).renderFrame(0);
+      runner.run(std::string("VideoFrame.toString/") + format.second, [&](uint64_t iterations) {
+         for (uint64_t i=0; i<iterations; ++i)
+            doNotOptimize(frame->toString());
+      });
+   }
+}
+
+
+static void benchmarkVJConfig(BenchmarkRunner &runner)
+{
+   // a database of our own, so that we don't mess with the real one
+   std::filesystem::path path = std::filesystem::temp_directory_path() / ("HotPathBenchmark-" + std::to_string(getpid())) / "VJConfig.db";
+   {
+      VJConfig config(path);
+      XYDriverConfig xyDriverConfig;
+      config.setXYDriverConfig(xyDriverConfig);
+
+      runner.run("VJConfig.getXYDriverConfig", [&](uint64_t iterations) {
+         for (uint64_t i=0; i<iterations; ++i)
+            doNotOptimize(config.getXYDriverConfig());
+      });
+      runner.run("VJConfig.setXYDriverConfig", [&](uint64_t iterations) {
+         for (uint64_t i=0; i<iterations; ++i)
+         {
+            xyDriverConfig.xy00.x = (float)(i % 10);
+            config.setXYDriverConfig(xyDriverConfig);
+         }
+      });
+   }
+   std::filesystem::remove_all(path.parent_path());
+}
+
+
+/// <summary>
+/// Times the code that runs for every frame or every command, each on its
+/// own, and writes the results as JSON so that builds can be compared.
+///
+///   HotPathBenchmark [--filter TEXT] [--quick] [--output FILE]
+///
+/// --filter runs only the benchmarks with TEXT in their names, --quick
+/// measures less carefully but a lot sooner, and --output writes the JSON to
+/// a file rather than stdout.  Progress goes to stderr.
+/// </summary>
+int main(int argc, const char **argv)
+{
+   std::string filter;
+   std::string outputPath;
+   bool quick = false;
+   for (int i=1; i<argc; ++i)
+   {
+      if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+         filter = argv[++i];
+      else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+         outputPath = argv[++i];
+      else if (strcmp(argv[i], "--quick") == 0)
+         quick = true;
+      else
+      {
+         std::cerr << "usage: HotPathBenchmark [--filter TEXT] [--quick] [--output FILE]" << std::endl;
+         return 1;
+      }
+   }
+
+   BenchmarkRunner runner(filter, std::chrono::milliseconds(quick ? 20 : 100), quick ? 3 : 10);
+   benchmarkFrameHandler(runner);
+   benchmarkBackgroundModel(runner);
+   benchmarkXYDriver(runner);
+   benchmarkSPIDAC(runner);
+   benchmarkCommandProcessor(runner);
+   benchmarkVideoFrame(runner);
+   benchmarkVJConfig(runner);
+
+   if (outputPath.empty())
+   {
+      runner.writeJson(std::cout);
+   }
+   else
+   {
+      std::ofstream out(outputPath);
+      runner.writeJson(out);
+      if (!out)
+      {
+         std::cerr << "HotPathBenchmark: can't write " << outputPath << std::endl;
+         return 1;
+      }
+   }
+
+   return 0;
+}
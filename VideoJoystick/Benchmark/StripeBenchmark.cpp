@@ -0,0 +1,83 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "FrameHandler.h"
+
+
+// a frame rather like what the camera sees: dim, noisy and mostly grey, with
+// a small red dot
+static std::shared_ptr<VideoFrame> makeFrame()
+{
+   constexpr int width = 640;
+   constexpr int height = 480;
+   std::vector<uint8_t> pixels(3 * width * height);
+
+   srand(42);
+   for (int i=0; i<width*height; ++i)
+   {
+      int level = 40 + rand() % 120;
+      pixels[3*i] = (uint8_t)(level + rand() % 16);
+      pixels[3*i + 1] = (uint8_t)(level + rand() % 16);
+      pixels[3*i + 2] = (uint8_t)(level + rand() % 16);
+   }
+   for (int y=200; y<212; ++y)
+   {
+      for (int x=300; x<312; ++x)
+      {
+         pixels[3*(y*width + x)] = 20;
+         pixels[3*(y*width + x) + 1] = 30;
+         pixels[3*(y*width + x) + 2] = 240;
+      }
+   }
+
+   auto frame = std::make_shared<VectorVideoFrame>(&pixels[0], pixels.size());
+   frame->setFormat(FrameFormat::create(PixelFormat::BGR24, width, height));
+   return frame;
+}
+
+
+/// <summary>
+/// Measures full-frame FrameHandler::HandleFrame time against the number of
+/// stripes the frame is split into
+/// </summary>
+int main(int argc, const char **argv)
+{
+   int maxStripes = std::max(4u, std::thread::hardware_concurrency());
+   int frames = argc > 1 ? atoi(argv[1]) : 2000;
+
+   std::shared_ptr<VideoFrame> frame = makeFrame();
+
+   std::cout << "stripes,usPerFrame,speedup" << std::endl;
+   double singleStripeTime = 0;
+   for (int stripes=1; stripes<=maxStripes; ++stripes)
+   {
+      // no tracking window; we want to measure the whole frame every time
+      FrameHandler frameHandler(stripes);
+      frameHandler.setWindowSize(0);
+
+      // get through the warmup frames
+      for (int i=0; i<200; ++i)
+         frameHandler.HandleFrame(frame);
+
+      auto start = std::chrono::steady_clock::now();
+      for (int i=0; i<frames; ++i)
+         frameHandler.HandleFrame(frame);
+      std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+      double usPerFrame = elapsed.count() / frames;
+      if (stripes == 1)
+         singleStripeTime = usPerFrame;
+      std::cout << stripes << "," << usPerFrame << "," << singleStripeTime / usPerFrame << std::endl;
+   }
+
+   return 0;
+}
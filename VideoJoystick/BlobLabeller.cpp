@@ -0,0 +1,326 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <algorithm>
+#include <cstring>
+#include "BlobLabeller.h"
+
+
+/// <summary>
+/// Adds another blob's totals to ours, as when two turn out to be one
+/// </summary>
+void Blob::add(const Blob &blob)
+{
+   area += blob.area;
+   left = std::min(left, blob.left);
+   top = std::min(top, blob.top);
+   right = std::max(right, blob.right);
+   bottom = std::max(bottom, blob.bottom);
+   weightSum += blob.weightSum;
+   weightedXSum += blob.weightedXSum;
+   weightedYSum += blob.weightedYSum;
+}
+
+
+
+// =====================================================
+//  class BlobLabeller
+// =====================================================
+
+/// <summary>
+/// Initializes a new instance of class BlobLabeller for frames up to the
+/// given size
+/// </summary>
+BlobLabeller::BlobLabeller(int width, int height)
+{
+   this->width = width;
+   this->height = height;
+   wordsPerRow = (width + 63) / 64;
+   mask.reset(new uint64_t[wordsPerRow * height]);
+   std::fill(mask.get(), mask.get() + wordsPerRow * height, 0);
+   weights.reset(new uint8_t[width * height]);
+
+   // a row can't have more runs than every other pixel
+   currentRuns.reset(new Run[width / 2 + 1]);
+   previousRuns.reset(new Run[width / 2 + 1]);
+
+   parents.reset(new int[MaxLabels]);
+   labelBlobs.reset(new Blob[MaxLabels]);
+}
+
+
+/// <summary>
+/// Paints hits into the mask; hits outside the frame we're set up for are
+/// ignored, the same as the detectors do
+/// </summary>
+void BlobLabeller::addHits(const uint16_t *hitX, const uint16_t *hitY, const uint8_t *hitWeight, uint32_t count)
+{
+   for (uint32_t i=0; i<count; ++i)
+   {
+      int x = hitX[i];
+      int y = hitY[i];
+      if (x >= width || y >= height)
+         continue;
+
+      mask[wordsPerRow * y + x / 64] |= 1ull << (x % 64);
+
+      // a hit with no weight still says where the blob is
+      weights[width * y + x] = std::max(hitWeight[i], (uint8_t)1);
+
+      if (!haveHits)
+      {
+         haveHits = true;
+         hitLeft = hitRight = x;
+         hitTop = hitBottom = y;
+      }
+      else
+      {
+         hitLeft = std::min(hitLeft, x);
+         hitRight = std::max(hitRight, x);
+         hitTop = std::min(hitTop, y);
+         hitBottom = std::max(hitBottom, y);
+      }
+   }
+}
+
+
+/// <summary>
+/// Labels the hits painted since last time and lists the blobs, leaving the
+/// mask clear for next time.  Returns false if there were too many blobs to
+/// keep track of, in which case none are listed.
+/// </summary>
+bool BlobLabeller::label()
+{
+   labelCount = 0;
+   blobCount = 0;
+   blobsFound = 0;
+   if (!haveHits)
+      return true;
+
+   int leftWord = hitLeft / 64;
+   int rightWord = hitRight / 64;
+   int previousCount = 0;
+   for (int y=hitTop; y<=hitBottom; ++y)
+   {
+      uint64_t *row = &mask[wordsPerRow * y];
+      const uint8_t *rowWeights = &weights[width * y];
+      int currentCount = 0;
+      int previous = 0;
+
+      for (int word=leftWord; word<=rightWord; )
+      {
+         uint64_t bits = row[word];
+         if (bits == 0)
+         {
+            ++word;
+            continue;
+         }
+
+         // the run goes on until the first clear bit, which may be words
+         // later; bits before it in this word were cleared by earlier runs,
+         // so the words it covers end up clear apart from the last
+         int start = 64 * word + __builtin_ctzll(bits);
+         int endWord = word;
+         uint64_t clear = ~bits & (~0ull << (start % 64));
+         while (clear == 0 && endWord < rightWord)
+         {
+            row[endWord] = 0;
+            clear = ~row[++endWord];
+         }
+         int end = (clear == 0) ? 64 * (endWord + 1) : 64 * endWord + __builtin_ctzll(clear);
+         if (clear == 0)
+            row[endWord] = 0;
+         else
+            row[endWord] &= ~0ull << (end % 64);
+         word = endWord;
+
+         // the run's totals
+         Blob run;
+         run.area = end - start;
+         run.left = start;
+         run.right = end - 1;
+         run.top = run.bottom = y;
+         uint64_t weightedX = 0;
+         for (int x=start; x<end; ++x)
+         {
+            run.weightSum += rowWeights[x];
+            weightedX += (uint64_t)rowWeights[x] * x;
+         }
+         run.weightedXSum = weightedX;
+         run.weightedYSum = run.weightSum * y;
+
+         // join it to the blobs of the runs above that touch it, diagonally
+         // included; the last of those may touch our next run too, so we
+         // don't move past it
+         while (previous < previousCount && previousRuns[previous].end < start)
+            ++previous;
+         int label = -1;
+         for (int i=previous; i<previousCount && previousRuns[i].start <= end; ++i)
+         {
+            int other = findRoot(previousRuns[i].label);
+            label = (label < 0) ? other : unite(label, other);
+         }
+
+         if (label < 0)
+         {
+            if (labelCount == MaxLabels)
+            {
+               clearMask();
+               labelCount = 0;
+               return false;
+            }
+            label = labelCount++;
+            parents[label] = label;
+            labelBlobs[label] = run;
+         }
+         else
+            labelBlobs[label].add(run);
+
+         currentRuns[currentCount].start = start;
+         currentRuns[currentCount].end = end;
+         currentRuns[currentCount].label = label;
+         ++currentCount;
+      }
+
+      // an empty row leaves nothing for the next one to join
+      std::swap(currentRuns, previousRuns);
+      previousCount = currentCount;
+   }
+
+   haveHits = false;
+   listBlobs();
+   return true;
+}
+
+
+/// <summary>
+/// Returns the root of the label's tree, flattening the path to it on the
+/// way so that it's quicker next time
+/// </summary>
+int BlobLabeller::findRoot(int label)
+{
+   int root = label;
+   while (parents[root] != root)
+      root = parents[root];
+   while (parents[label] != root)
+   {
+      int next = parents[label];
+      parents[label] = root;
+      label = next;
+   }
+   return root;
+}
+
+
+/// <summary>
+/// Merges the blobs of two roots, returning the root of the result; the
+/// older label wins so that roots only ever point backwards
+/// </summary>
+int BlobLabeller::unite(int a, int b)
+{
+   if (a == b)
+      return a;
+   if (b < a)
+      std::swap(a, b);
+   parents[b] = a;
+   labelBlobs[a].add(labelBlobs[b]);
+   return a;
+}
+
+
+/// <summary>
+/// Lists the largest of the blobs, by way of their roots
+/// </summary>
+void BlobLabeller::listBlobs()
+{
+   int smallest = 0;
+   for (int label=0; label<labelCount; ++label)
+   {
+      if (parents[label] != label)
+         continue;
+
+      const Blob &blob = labelBlobs[label];
+      ++blobsFound;
+      if (blobCount < MaxBlobs)
+      {
+         blobs[blobCount] = blob;
+         if (blob.area < blobs[smallest].area)
+            smallest = blobCount;
+         ++blobCount;
+      }
+      else if (blob.area > blobs[smallest].area)
+      {
+         // bump the smallest we have
+         blobs[smallest] = blob;
+         for (int i=0; i<blobCount; ++i)
+            if (blobs[i].area < blobs[smallest].area)
+               smallest = i;
+      }
+   }
+}
+
+
+/// <summary>
+/// Clears whatever's left of the mask after giving up on labelling it
+/// </summary>
+void BlobLabeller::clearMask()
+{
+   int leftWord = hitLeft / 64;
+   int rightWord = hitRight / 64;
+   for (int y=hitTop; y<=hitBottom; ++y)
+      std::memset(&mask[wordsPerRow * y + leftWord], 0, sizeof(uint64_t) * (rightWord - leftWord + 1));
+   haveHits = false;
+}
+
+
+/// <summary>
+/// Chooses the blob that's most likely the dot by the given policy; without
+/// an expected position the closest is the largest.  Returns null if there
+/// are no blobs.
+/// </summary>
+const Blob *BlobLabeller::selectBlob(BlobPolicy policy, bool haveExpected, float expectedX, float expectedY) const
+{
+   if (blobCount == 0)
+      return nullptr;
+
+   const Blob *largest = &blobs[0];
+   for (int i=1; i<blobCount; ++i)
+      if (blobs[i].area > largest->area)
+         largest = &blobs[i];
+   if (policy == BlobPolicy::Largest || (policy == BlobPolicy::Closest && !haveExpected))
+      return largest;
+
+   // a blob too small to count only wins if they all are, in which case the
+   // largest is as good as any
+   if (largest->area < MinimumArea)
+      return largest;
+
+   const Blob *best = nullptr;
+   float bestScore = 0;
+   for (int i=0; i<blobCount; ++i)
+   {
+      const Blob &blob = blobs[i];
+      if (blob.area < MinimumArea)
+         continue;
+
+      float score;
+      if (policy == BlobPolicy::Closest)
+      {
+         float dx = blob.getX() - expectedX;
+         float dy = blob.getY() - expectedY;
+         score = -(dx*dx + dy*dy);
+      }
+      else
+         score = blob.getMeanIntensity();
+
+      if (best == nullptr || score > bestScore)
+      {
+         best = &blob;
+         bestScore = score;
+      }
+   }
+   return best;
+}
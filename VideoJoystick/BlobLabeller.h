@@ -0,0 +1,133 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef BLOBLABELLER_H
+#define BLOBLABELLER_H
+
+#include <stdint.h>
+#include <memory>
+
+
+/// <summary>
+/// A connected group of hits; the centroid is weighted the same as the scan
+/// results', and the bounds are inclusive
+/// </summary>
+struct Blob {
+   uint32_t area = 0;
+   int left = 0;
+   int top = 0;
+   int right = 0;
+   int bottom = 0;
+   uint64_t weightSum = 0;
+   uint64_t weightedXSum = 0;
+   uint64_t weightedYSum = 0;
+
+   float getX() const { return (float)((double)weightedXSum / weightSum); }
+   float getY() const { return (float)((double)weightedYSum / weightSum); }
+   float getMeanIntensity() const { return (float)((double)weightSum / area); }
+   void add(const Blob &blob);
+};
+
+
+/// <summary>
+/// Which blob is the dot: the one with the most pixels, the one nearest to
+/// where we expect the dot to be, or the one with the highest mean weight
+/// </summary>
+enum class BlobPolicy {
+   Largest,
+   Closest,
+   Brightest
+};
+
+
+/// <summary>
+/// Groups hits into 8-connected blobs, so that a reflection or a second red
+/// object is something we can choose against rather than something that
+/// drags the dot's position toward it.
+///
+/// Hits get painted into a bit mask of the frame, along with their weights,
+/// since the detectors' hit lists aren't in any useful order.  The mask is
+/// then labelled in a single pass a row at a time: each run of set bits
+/// either joins the blobs of the runs it touches in the row above, merging
+/// them if there are several, or starts a new one.  Only the runs of the
+/// previous row are kept, and labelling clears the mask as it goes, so the
+/// work is proportional to the rows the hits cover plus the hits themselves.
+///
+/// Everything is allocated up front.  There's room for MaxLabels blobs as
+/// they're found, before merging; a frame that fragments into more than that
+/// can't be labelled, and the caller had better have another way of locating
+/// the dot.  Of the blobs found, the MaxBlobs largest are listed.
+/// </summary>
+class BlobLabeller final
+{
+public:
+   static constexpr int MaxBlobs = 32;
+   static constexpr int MaxLabels = 16384;
+
+   // blobs smaller than this are only chosen if there's nothing bigger, so
+   // that a stray pixel can't be the closest or brightest thing around
+   static constexpr uint32_t MinimumArea = 4;
+
+public:
+   BlobLabeller(int width, int height);
+
+   void addHits(const uint16_t *hitX, const uint16_t *hitY, const uint8_t *hitWeight, uint32_t count);
+   bool label();
+
+   int getBlobCount() const { return blobCount; }
+   int getBlobsFound() const { return blobsFound; }
+   const Blob *getBlobs() const { return blobs; }
+   const Blob *selectBlob(BlobPolicy policy, bool haveExpected, float expectedX, float expectedY) const;
+
+private:
+   /// <summary>
+   /// A run of set bits in one row; end is exclusive
+   /// </summary>
+   struct Run {
+      int start;
+      int end;
+      int label;
+   };
+
+private:
+   int findRoot(int label);
+   int unite(int a, int b);
+   void listBlobs();
+   void clearMask();
+
+private:
+   int width;
+   int height;
+
+   // a bit per pixel, in rows of whole words, and a weight per pixel that's
+   // only meaningful where the bit is set
+   int wordsPerRow;
+   std::unique_ptr<uint64_t[]> mask;
+   std::unique_ptr<uint8_t[]> weights;
+
+   // the bounds of the hits painted since the last label
+   bool haveHits = false;
+   int hitLeft = 0;
+   int hitTop = 0;
+   int hitRight = 0;
+   int hitBottom = 0;
+
+   // the runs of the row we're on and the one above it
+   std::unique_ptr<Run[]> currentRuns;
+   std::unique_ptr<Run[]> previousRuns;
+
+   // the union-find forest of labels; each root holds the totals of its blob
+   int labelCount = 0;
+   std::unique_ptr<int[]> parents;
+   std::unique_ptr<Blob[]> labelBlobs;
+
+   int blobCount = 0;
+   int blobsFound = 0;
+   Blob blobs[MaxBlobs];
+};
+
+
+#endif
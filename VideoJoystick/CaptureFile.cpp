@@ -0,0 +1,85 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <limits.h>
+#include <string.h>
+#include "CaptureFile.h"
+
+
+/// <summary>
+/// Creates a header for frames of the given format
+/// </summary>
+CaptureFileHeader CaptureFileHeader::create(const FrameFormat &format)
+{
+   CaptureFileHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, Magic, sizeof(header.magic));
+   header.version = CurrentVersion;
+   header.headerSize = sizeof(header);
+
+   header.pixelFormat = (uint32_t)format.pixelFormat;
+   header.width = (uint32_t)format.width;
+   header.height = (uint32_t)format.height;
+   header.planeCount = (uint32_t)format.planeCount;
+   for (int i=0; i<FrameFormat::MaxPlanes; ++i)
+   {
+      header.planeOffset[i] = (uint32_t)format.planeOffset[i];
+      header.planeStride[i] = (uint32_t)format.planeStride[i];
+   }
+   return header;
+}
+
+
+/// <summary>
+/// Returns true if it looks like a header we know how to read.  The layout
+/// goes straight into a FrameFormat that the scanners trust, so anything
+/// that wouldn't fit in its ints, or rows shorter than the pixels in them,
+/// makes it invalid rather than something to read out of bounds by.
+/// </summary>
+bool CaptureFileHeader::isValid() const
+{
+   if (memcmp(magic, Magic, sizeof(magic)) != 0 ||
+         version != CurrentVersion ||
+         headerSize < sizeof(CaptureFileHeader) ||
+         pixelFormat > (uint32_t)PixelFormat::BayerBGGR10Packed)
+      return false;
+
+   // getMinimumStride works in ints, so the width has to leave it room
+   PixelFormat format = (PixelFormat)pixelFormat;
+   if (width == 0 || width > INT_MAX / 5 || height == 0 || height > INT_MAX)
+      return false;
+   if (planeCount != ((format == PixelFormat::YUV420) ? 3u : 1u))
+      return false;
+
+   // the chroma planes of YUV420 are half width
+   int minimumStride = FrameFormat::getMinimumStride(format, (int)width);
+   for (uint32_t plane=0; plane<planeCount; ++plane)
+   {
+      uint32_t planeMinimumStride = (uint32_t)((plane == 0) ? minimumStride : minimumStride / 2);
+      if (planeOffset[plane] > INT_MAX || planeStride[plane] > INT_MAX || planeStride[plane] < planeMinimumStride)
+         return false;
+   }
+   return true;
+}
+
+
+/// <summary>
+/// Returns the format of the frames
+/// </summary>
+FrameFormat CaptureFileHeader::getFormat() const
+{
+   FrameFormat format;
+   format.pixelFormat = (PixelFormat)pixelFormat;
+   format.width = (int)width;
+   format.height = (int)height;
+   format.planeCount = (int)planeCount;
+   for (int i=0; i<FrameFormat::MaxPlanes; ++i)
+   {
+      format.planeOffset[i] = (int)planeOffset[i];
+      format.planeStride[i] = (int)planeStride[i];
+   }
+   return format;
+}
@@ -0,0 +1,65 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef CAPTUREFILE_H
+#define CAPTUREFILE_H
+
+#include <stdint.h>
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// Start of a capture file, as written by FrameRecorder and replayed by
+/// FileFrameGrabber: this header describing the frames, then for each frame
+/// a CaptureFrameHeader followed by its pixels exactly as the frame grabber
+/// gave them to us, padding and all, padded in turn to a multiple of
+/// Alignment bytes.  Everything is little-endian, which is all that the Pi
+/// and the x86 boxes we replay on know how to be.
+/// </summary>
+struct CaptureFileHeader {
+   static constexpr char Magic[8] = { 'V', 'J', 'C', 'A', 'P', 'T', 'U', 'R' };
+   static constexpr uint32_t CurrentVersion = 1;
+   static constexpr uint32_t Alignment = 8;
+
+   char magic[8];
+   uint32_t version;
+   uint32_t headerSize;
+
+   // the frames' FrameFormat
+   uint32_t pixelFormat;
+   uint32_t width;
+   uint32_t height;
+   uint32_t planeCount;
+   uint32_t planeOffset[FrameFormat::MaxPlanes];
+   uint32_t planeStride[FrameFormat::MaxPlanes];
+
+   uint32_t reserved[2];
+
+   static CaptureFileHeader create(const FrameFormat &format);
+   bool isValid() const;
+   FrameFormat getFormat() const;
+
+   static uint64_t getPaddedLength(uint64_t length) { return (length + Alignment - 1) & ~(uint64_t)(Alignment - 1); }
+};
+static_assert(sizeof(CaptureFileHeader) == 64, "CaptureFileHeader layout changed");
+
+
+/// <summary>
+/// Precedes each frame's pixels in a capture file
+/// </summary>
+struct CaptureFrameHeader {
+   // the frame's timestamp and camera sequence number
+   uint64_t timestamp;
+   uint64_t sequence;
+
+   // length of the pixel data that follows, not counting padding
+   uint32_t length;
+   uint32_t reserved;
+};
+static_assert(sizeof(CaptureFrameHeader) == 24, "CaptureFrameHeader layout changed");
+
+
+#endif
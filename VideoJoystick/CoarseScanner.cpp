@@ -0,0 +1,277 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <algorithm>
+#include "CoarseScanner.h"
+#include "PackedPixels.h"
+
+
+/// <summary>
+/// Initializes a new instance of class CoarseScanner for frames up to the
+/// given size
+/// </summary>
+CoarseScanner::CoarseScanner(int width, int height)
+{
+   this->width = width;
+   this->height = height;
+
+   // one group of 4 more than we need, since a kernel might round up
+   partialSums.resize(((width + 3) / 4 + 1) * MaxSumsPerQuad);
+}
+
+
+/// <summary>
+/// Returns true if we know how to downsample the given format
+/// </summary>
+bool CoarseScanner::isFormatSupported(PixelFormat format)
+{
+   return isPackedRGB(format);
+}
+
+
+/// <summary>
+/// Finds the regions of the window that might have the dot in them, using
+/// blocks of 4 or 8 pixels on a side; the window has to be clipped to the
+/// frame already.  Returns the number of regions, which are available from
+/// getRegions, or -1 if there are too many to be worth bothering with.
+/// </summary>
+int CoarseScanner::findRegions(const FrameFormat &format, const uint8_t *pixelData, const ScanWindow &window, int blockSize)
+{
+   regionCount = 0;
+   blocksScanned = 0;
+   candidateBlocks = 0;
+   if (window.getArea() <= 0)
+      return 0;
+
+   blockSize = (blockSize >= 8) ? 8 : 4;
+   int regions = -1;
+   dispatchPackedRGB(format.pixelFormat, [&](auto packed) { regions = scanBlocks<decltype(packed)::value>(format, pixelData, window, blockSize); });
+   return regions;
+}
+
+
+/// <summary>
+/// findRegions for a particular format
+/// </summary>
+template <PixelFormat Format>
+int CoarseScanner::scanBlocks(const FrameFormat &format, const uint8_t *pixelData, const ScanWindow &window, int blockSize)
+{
+   constexpr int SumsPerQuad = getSumsPerQuad<Format>();
+
+   // blocks are aligned to the frame rather than the window, so that the
+   // groups of 4 pixels that we sum are too
+   int left = window.left & ~(blockSize - 1);
+   int right = std::min(window.right, width);
+   int firstQuad = left / 4;
+   int lastQuad = (right + 3) / 4;
+   int windowBottom = std::min(window.bottom, height);
+
+   const uint8_t *plane = pixelData + format.planeOffset[0];
+   int stride = format.planeStride[0];
+   for (int blockTop = window.top & ~(blockSize - 1); blockTop < windowBottom; blockTop += blockSize)
+   {
+      int top = std::max(blockTop, window.top);
+      int bottom = std::min(blockTop + blockSize, windowBottom);
+      std::fill(&partialSums[firstQuad * SumsPerQuad], &partialSums[lastQuad * SumsPerQuad], 0);
+
+      for (int y=top; y<bottom; ++y)
+         sumRow<Format>(plane + stride * y, left, right);
+
+      if (!evaluateBlocks<Format>(window, blockSize, top, bottom, firstQuad, lastQuad))
+         return -1;
+   }
+
+   return regionCount;
+}
+
+
+/// <summary>
+/// How many partial sums sumRow keeps for each group of 4 pixels: SSSE3 builds
+/// have one for each pair of bytes, since that's what pmaddubsw gives us,
+/// everything else one for each pixel
+/// </summary>
+template <PixelFormat Format>
+constexpr int CoarseScanner::getSumsPerQuad()
+{
+#if defined(__SSSE3__) && !defined(__ARM_NEON)
+   return 2 * PackedLayout<Format>::BytesPerPixel;
+#else
+   return 4;
+#endif
+}
+
+
+/// <summary>
+/// Adds the scores of part of a row of packed pixels to the partial sums of
+/// the groups of 4 pixels they belong to; left has to be a multiple of 4.
+/// NEON and SSSE3 builds take 16 pixels at a time and leave the rest of the
+/// row to the scalar loop.
+/// </summary>
+template <PixelFormat Format>
+void CoarseScanner::sumRow(const uint8_t *row, int left, int right)
+{
+   using Layout = PackedLayout<Format>;
+   constexpr int BytesPerPixel = Layout::BytesPerPixel;
+   constexpr int SumsPerQuad = getSumsPerQuad<Format>();
+
+   int x = left;
+
+#if defined(__ARM_NEON)
+
+   for (; x + 16 <= right; x += 16)
+   {
+      uint8x16_t r, g, b;
+      if constexpr (BytesPerPixel == 3)
+      {
+         uint8x16x3_t v = vld3q_u8(row + 3 * x);
+         r = v.val[Layout::Red];
+         g = v.val[Layout::Green];
+         b = v.val[Layout::Blue];
+      }
+      else
+      {
+         uint8x16x4_t v = vld4q_u8(row + 4 * x);
+         r = v.val[Layout::Red];
+         g = v.val[Layout::Green];
+         b = v.val[Layout::Blue];
+      }
+
+      // 4r - 3(g + b), widened to 16 bits 8 pixels at a time
+      auto score = [](uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+         int16x8_t red = vreinterpretq_s16_u16(vshll_n_u8(r, 2));
+         int16x8_t greenBlue = vreinterpretq_s16_u16(vaddl_u8(g, b));
+         return vmlsq_n_s16(red, greenBlue, GreenBlueWeight);
+      };
+
+      int16_t *sums = &partialSums[x];
+      vst1q_s16(sums, vaddq_s16(vld1q_s16(sums), score(vget_low_u8(r), vget_low_u8(g), vget_low_u8(b))));
+      vst1q_s16(sums + 8, vaddq_s16(vld1q_s16(sums + 8), score(vget_high_u8(r), vget_high_u8(g), vget_high_u8(b))));
+   }
+
+#elif defined(__SSSE3__)
+
+   // the weight of every byte of 16 pixels, so that pmaddubsw can score the
+   // pixels and add pairs of bytes in one go; a pair may straddle two pixels
+   // but never two groups of 4, since those are an even number of bytes
+   struct ScoreWeights {
+      int8_t weight[BytesPerPixel][16];
+   };
+   static constexpr ScoreWeights weights = [] {
+      ScoreWeights w = {};
+      for (int i=0; i<16 * BytesPerPixel; ++i)
+      {
+         int channel = i % BytesPerPixel;
+         int weight = 0;
+         if (channel == Layout::Red)
+            weight = RedWeight;
+         else if (channel == Layout::Green || channel == Layout::Blue)
+            weight = -GreenBlueWeight;
+         w.weight[i / 16][i % 16] = (int8_t)weight;
+      }
+      return w;
+   }();
+
+   for (; x + 16 <= right; x += 16)
+   {
+      const __m128i *p = (const __m128i *)(row + BytesPerPixel * x);
+      int16_t *sums = &partialSums[x / 4 * SumsPerQuad];
+      for (int load=0; load<BytesPerPixel; ++load)
+      {
+         __m128i score = _mm_maddubs_epi16(_mm_loadu_si128(p + load), _mm_loadu_si128((const __m128i *)weights.weight[load]));
+         __m128i *sum = (__m128i *)(sums + 8 * load);
+         _mm_storeu_si128(sum, _mm_add_epi16(_mm_loadu_si128(sum), score));
+      }
+   }
+
+#endif
+
+   // whatever is left over, or everything if we have no vector support; a
+   // group's partial sums only ever get added together, so it doesn't matter
+   // which of them a pixel goes into
+   for (; x < right; ++x)
+   {
+      const uint8_t *p = row + BytesPerPixel * x;
+      int score = RedWeight * p[Layout::Red] - GreenBlueWeight * (p[Layout::Green] + p[Layout::Blue]);
+      partialSums[x / 4 * SumsPerQuad + x % 4] += (int16_t)score;
+   }
+}
+
+
+/// <summary>
+/// Totals the partial sums into blocks for a row of blocks that we've
+/// finished summing, and makes regions of the candidates; returns false if
+/// there are too many regions
+/// </summary>
+template <PixelFormat Format>
+bool CoarseScanner::evaluateBlocks(const ScanWindow &window, int blockSize, int blockTop, int blockBottom, int firstQuad, int lastQuad)
+{
+   constexpr int SumsPerQuad = getSumsPerQuad<Format>();
+
+   auto quadScore = [this](int quad) {
+      const int16_t *sums = &partialSums[quad * SumsPerQuad];
+      int score = 0;
+      for (int i=0; i<SumsPerQuad; ++i)
+         score += sums[i];
+      return score;
+   };
+
+   int quadsPerBlock = blockSize / 4;
+   for (int quad=firstQuad; quad<lastQuad; quad+=quadsPerBlock)
+   {
+      int score = quadScore(quad);
+      if (quadsPerBlock == 2 && quad + 1 < lastQuad)
+         score += quadScore(quad + 1);
+
+      ++blocksScanned;
+      if (score <= 0)
+         continue;
+      ++candidateBlocks;
+
+      // a margin of a block all round catches the bits of the dot that
+      // didn't tip their own blocks over
+      int blockLeft = 4 * quad;
+      ScanWindow region(
+         std::max(window.left, blockLeft - blockSize),
+         std::max(window.top, blockTop - blockSize),
+         std::min(window.right, blockLeft + 2 * blockSize),
+         std::min(window.bottom, blockBottom + blockSize)
+         );
+      if (!addRegion(region))
+         return false;
+   }
+   return true;
+}
+
+
+/// <summary>
+/// Adds a region to our list, merging it with any that it touches; returns
+/// false if the list is full
+/// </summary>
+bool CoarseScanner::addRegion(ScanWindow region)
+{
+   // merging can make a region big enough to touch others it didn't before,
+   // so keep going until it doesn't touch any
+   for (int i=0; i<regionCount; )
+   {
+      const ScanWindow &other = regions[i];
+      if (region.left <= other.right && other.left <= region.right && region.top <= other.bottom && other.top <= region.bottom)
+      {
+         region.left = std::min(region.left, other.left);
+         region.top = std::min(region.top, other.top);
+         region.right = std::max(region.right, other.right);
+         region.bottom = std::max(region.bottom, other.bottom);
+         regions[i] = regions[--regionCount];
+         i = 0;
+      }
+      else
+         ++i;
+   }
+
+   if (regionCount == MaxRegions)
+      return false;
+   regions[regionCount++] = region;
+   return true;
+}
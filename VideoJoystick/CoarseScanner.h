@@ -0,0 +1,91 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef COARSESCANNER_H
+#define COARSESCANNER_H
+
+#include <stdint.h>
+#include <vector>
+#include "DotDetector.h"
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// The first half of a coarse-to-fine search: finds where the dot might be
+/// from a box-filtered downsample of the frame, so that the full resolution
+/// scan can be limited to those places.  The frame is divided into blocks
+/// of 4x4 or 8x8 pixels and each pixel's score, 4r - 3(g + b), is summed
+/// over its block in one streaming pass; any block that comes out positive
+/// makes a candidate region of itself plus a block's margin all round.
+/// Regions that touch are merged.
+///
+/// That's the same as asking whether the block's average red is more than
+/// three quarters of its average green plus blue, which is looser than the
+/// r > g + b that the full resolution scan uses since a block that's only
+/// partly covered by the dot is averaged with the background; grey never
+/// passes.  False candidates just cost a little extra full resolution
+/// scanning.
+///
+/// Since the score is linear it can be summed without pulling the channels
+/// apart: SSSE3 builds multiply and add pairs of bytes straight from the
+/// frame with pmaddubsw, NEON builds deinterleave with vld3q/vld4q, 16 pixels
+/// at a time either way.  Scores are summed a row at a time into a row of
+/// partial sums that stays in L1, so the frame is read once, in order.
+///
+/// Only packed RGB formats are supported; the YUV and Bayer kernels already
+/// work at reduced resolution.
+/// </summary>
+class CoarseScanner
+{
+public:
+   // at most this many regions; anything with more candidates than that is
+   // something we'd be better off scanning in full
+   static constexpr int MaxRegions = 8;
+
+public:
+   CoarseScanner(int width, int height);
+
+   static bool isFormatSupported(PixelFormat format);
+
+   int findRegions(const FrameFormat &format, const uint8_t *pixelData, const ScanWindow &window, int blockSize);
+   const ScanWindow *getRegions() const { return regions; }
+
+   uint32_t getBlocksScanned() const { return blocksScanned; }
+   uint32_t getCandidateBlocks() const { return candidateBlocks; }
+
+private:
+   // a pixel's score is RedWeight * r - GreenBlueWeight * (g + b)
+   static constexpr int RedWeight = 4;
+   static constexpr int GreenBlueWeight = 3;
+
+   // the most partial sums a group of 4 pixels can have
+   static constexpr int MaxSumsPerQuad = 8;
+
+private:
+   template <PixelFormat Format> static constexpr int getSumsPerQuad();
+   template <PixelFormat Format> int scanBlocks(const FrameFormat &format, const uint8_t *pixelData, const ScanWindow &window, int blockSize);
+   template <PixelFormat Format> void sumRow(const uint8_t *row, int left, int right);
+   template <PixelFormat Format> bool evaluateBlocks(const ScanWindow &window, int blockSize, int blockTop, int blockBottom, int firstQuad, int lastQuad);
+   bool addRegion(ScanWindow region);
+
+private:
+   int width;
+   int height;
+
+   // partial sums of the scores of the current row of blocks; each belongs
+   // to one group of 4 pixels, and how many each group has depends on how
+   // the kernel works.  At most 8 rows of scores from -1530 to 1020 go into
+   // each, which fits in 16 bits.  Allocated once up front.
+   std::vector<int16_t> partialSums;
+
+   ScanWindow regions[MaxRegions];
+   int regionCount = 0;
+   uint32_t blocksScanned = 0;
+   uint32_t candidateBlocks = 0;
+};
+
+
+#endif
@@ -0,0 +1,196 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <algorithm>
+#include "ColorTable.h"
+#include "PackedPixels.h"
+
+
+
+// =====================================================
+//  class ColorTable
+// =====================================================
+
+/// <summary>
+/// Initializes a new instance of class ColorTable with no dot colors
+/// </summary>
+ColorTable::ColorTable()
+{
+   std::fill(std::begin(bits), std::end(bits), 0);
+}
+
+
+/// <summary>
+/// Creates the table of the usual r > g + b rule.  A quantized color is the
+/// dot's only if every color it stands for passes, i.e. if its lowest red
+/// beats its highest green plus its highest blue; otherwise orange and pink
+/// near the edge of the rule would get let in with it.
+/// </summary>
+std::shared_ptr<const ColorTable> ColorTable::createDefault()
+{
+   constexpr int Shift = 8 - LevelBits;
+   constexpr int Top = (1 << Shift) - 1;
+   std::shared_ptr<ColorTable> table(new ColorTable());
+   for (int r=0; r<Levels; ++r)
+   {
+      for (int g=0; g<Levels; ++g)
+      {
+         for (int b=0; b<Levels; ++b)
+         {
+            int lowestRed = r << Shift;
+            int highestGreen = (g << Shift) + Top;
+            int highestBlue = (b << Shift) + Top;
+            table->setDotIndex((r << (2 * LevelBits)) | (g << LevelBits) | b, lowestRed > highestGreen + highestBlue);
+         }
+      }
+   }
+   return table;
+}
+
+
+/// <summary>
+/// Sets whether the color with the given index is one of the dot's
+/// </summary>
+void ColorTable::setDotIndex(int index, bool dot)
+{
+   if (dot)
+      bits[index >> 5] |= 1u << (index & 31);
+   else
+      bits[index >> 5] &= ~(1u << (index & 31));
+}
+
+
+/// <summary>
+/// Returns how many of the quantized colors are the dot's
+/// </summary>
+int ColorTable::getDotEntries() const
+{
+   int count = 0;
+   for (uint32_t word : bits)
+      count += __builtin_popcount(word);
+   return count;
+}
+
+
+
+// =====================================================
+//  class ColorTableTrainer
+// =====================================================
+
+/// <summary>
+/// Initializes a new instance of class ColorTableTrainer with no samples
+/// </summary>
+ColorTableTrainer::ColorTableTrainer()
+   : insideCounts(ColorTable::Entries), outsideCounts(ColorTable::Entries)
+{
+}
+
+
+/// <summary>
+/// Returns true if we know how to sample the given format
+/// </summary>
+bool ColorTableTrainer::isFormatSupported(PixelFormat format)
+{
+   return isPackedRGB(format);
+}
+
+
+/// <summary>
+/// Samples the colors of a frame whose dot is at the given position; frames
+/// of a format we don't support are ignored
+/// </summary>
+void ColorTableTrainer::addFrame(const VideoFrame &frame, float dotX, float dotY, float dotRadius)
+{
+   dispatchPackedRGB(frame.getFormat().pixelFormat, [&](auto packed) { addPixels<decltype(packed)::value>(frame, dotX, dotY, dotRadius); });
+}
+
+
+/// <summary>
+/// addFrame for a particular format
+/// </summary>
+template <PixelFormat Format>
+void ColorTableTrainer::addPixels(const VideoFrame &frame, float dotX, float dotY, float dotRadius)
+{
+   using Layout = PackedLayout<Format>;
+   const FrameFormat &format = frame.getFormat();
+   const uint8_t *plane = frame.getPixelData() + format.planeOffset[0];
+   int rows = format.getRowsAvailable(frame.getPixelDataLength());
+
+   float insideSquared = dotRadius * dotRadius;
+   float outsideSquared = OutsideFactor * OutsideFactor * insideSquared;
+   for (int y=0; y<rows; ++y)
+   {
+      const uint8_t *row = plane + format.planeStride[0] * y;
+      for (int x=0; x<format.width; ++x)
+      {
+         const uint8_t *p = row + Layout::BytesPerPixel * x;
+         int index = ColorTable::getIndex(p[Layout::Red], p[Layout::Green], p[Layout::Blue]);
+         float dx = x - dotX;
+         float dy = y - dotY;
+         float distanceSquared = dx*dx + dy*dy;
+         if (distanceSquared <= insideSquared)
+         {
+            ++insideCounts[index];
+            ++insideSamples;
+         }
+         else if (distanceSquared > outsideSquared)
+         {
+            ++outsideCounts[index];
+            ++outsideSamples;
+         }
+      }
+   }
+}
+
+
+/// <summary>
+/// Builds a table from the samples so far; returns null if there were no
+/// samples of the dot
+/// </summary>
+std::shared_ptr<const ColorTable> ColorTableTrainer::build() const
+{
+   if (insideSamples == 0)
+      return nullptr;
+
+   // the colors that are more the dot's than anything else's
+   constexpr int Levels = ColorTable::Levels;
+   std::shared_ptr<ColorTable> table(new ColorTable());
+   for (int i=0; i<ColorTable::Entries; ++i)
+      if (insideCounts[i] > outsideCounts[i])
+         table->setDotIndex(i, true);
+
+   // grow them into their neighbors that were never seen outside, so that a
+   // little change in lighting doesn't lose the dot; the neighbors are
+   // decided from the original table so that we only grow by one level
+   ColorTable trained = *table;
+   for (int r=0; r<Levels; ++r)
+   {
+      for (int g=0; g<Levels; ++g)
+      {
+         for (int b=0; b<Levels; ++b)
+         {
+            int index = (r << (2 * ColorTable::LevelBits)) | (g << ColorTable::LevelBits) | b;
+            if (!trained.isDotIndex(index))
+               continue;
+
+            for (int nr=std::max(r - 1, 0); nr<=std::min(r + 1, Levels - 1); ++nr)
+            {
+               for (int ng=std::max(g - 1, 0); ng<=std::min(g + 1, Levels - 1); ++ng)
+               {
+                  for (int nb=std::max(b - 1, 0); nb<=std::min(b + 1, Levels - 1); ++nb)
+                  {
+                     int neighbor = (nr << (2 * ColorTable::LevelBits)) | (ng << ColorTable::LevelBits) | nb;
+                     if (outsideCounts[neighbor] == 0)
+                        table->setDotIndex(neighbor, true);
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   return table;
+}
@@ -0,0 +1,92 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef COLORTABLE_H
+#define COLORTABLE_H
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// Says which colors are the dot's, by way of a lookup table of every color
+/// quantized to 5 bits a channel, a bit each; 32x32x32 bits is 4K, which
+/// stays in L1.  Classifying a pixel is one lookup whatever the rule that
+/// built the table, so a dot of any color can be told apart from its
+/// background as well as its colors can be.
+///
+/// Tables are never changed once they're in use; a new one gets built and
+/// swapped in, so a scan always sees one table from start to finish.
+/// </summary>
+class ColorTable
+{
+public:
+   static constexpr int LevelBits = 5;
+   static constexpr int Levels = 1 << LevelBits;
+   static constexpr int Entries = Levels * Levels * Levels;
+
+public:
+   ColorTable();
+
+   static std::shared_ptr<const ColorTable> createDefault();
+
+   static int getIndex(int r, int g, int b) { return ((r >> (8 - LevelBits)) << (2 * LevelBits)) | ((g >> (8 - LevelBits)) << LevelBits) | (b >> (8 - LevelBits)); }
+   bool isDot(int r, int g, int b) const { int i = getIndex(r, g, b); return (bits[i >> 5] >> (i & 31)) & 1; }
+   bool isDotIndex(int index) const { return (bits[index >> 5] >> (index & 31)) & 1; }
+   void setDotIndex(int index, bool dot);
+
+   int getDotEntries() const;
+
+private:
+   uint32_t bits[Entries / 32];
+};
+
+
+/// <summary>
+/// Builds a ColorTable from a frame and where the dot is in it.  Pixels within
+/// the given radius of the dot are samples of the dot's colors, and pixels
+/// further than OutsideFactor times that are samples of everything else; the
+/// ring in between is neither, since that's where the dot blends into its
+/// background.  A color is the dot's if more of its samples came from inside
+/// than outside, which keeps the false hits per frame down to about as many
+/// as the dot has pixels, whatever the color.  Since the dot only gives us a
+/// few dozen samples, its colors are then grown by one level in every
+/// direction, into colors that were never seen outside.
+///
+/// Only packed RGB frames are supported, since those are the only ones whose
+/// pixels are colors the table understands.
+/// </summary>
+class ColorTableTrainer
+{
+public:
+   // how much further than the dot's radius the outside starts
+   static constexpr int OutsideFactor = 3;
+
+public:
+   ColorTableTrainer();
+
+   static bool isFormatSupported(PixelFormat format);
+
+   void addFrame(const VideoFrame &frame, float dotX, float dotY, float dotRadius);
+   std::shared_ptr<const ColorTable> build() const;
+
+   uint64_t getInsideSamples() const { return insideSamples; }
+   uint64_t getOutsideSamples() const { return outsideSamples; }
+
+private:
+   template <PixelFormat Format> void addPixels(const VideoFrame &frame, float dotX, float dotY, float dotRadius);
+
+private:
+   std::vector<uint32_t> insideCounts;
+   std::vector<uint32_t> outsideCounts;
+   uint64_t insideSamples = 0;
+   uint64_t outsideSamples = 0;
+};
+
+
+#endif
@@ -0,0 +1,623 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <algorithm>
+#include "DotDetector.h"
+#include "PackedPixels.h"
+
+// the project files pass the instruction set in SIMD_FLAGS; a compiler that
+// wasn't told about it quietly builds the scalar kernels, so say so
+#if defined(__arm__) && !defined(__ARM_NEON)
+   #warning "no NEON: the Pi build needs SIMD_FLAGS=-mfpu=neon-fp-armv8 -mfloat-abi=hard"
+#elif (defined(__x86_64__) || defined(__i386__)) && !defined(__SSSE3__)
+   #warning "no SSSE3: x86 builds need SIMD_FLAGS=-mssse3"
+#endif
+
+
+
+// =====================================================
+//  Bayer layouts
+// =====================================================
+
+namespace {
+   /// <summary>
+   /// Where red is in the 2x2 cell of a Bayer format; blue is diagonally
+   /// opposite and green is the other two
+   /// </summary>
+   template <PixelFormat Format> struct BayerLayout;
+
+   template <bool IsPacked, int RedColumn, int RedRow> struct BayerLayoutOf {
+      static constexpr bool Packed = IsPacked;
+      static constexpr int RedX = RedColumn;
+      static constexpr int RedY = RedRow;
+   };
+
+   template <> struct BayerLayout<PixelFormat::BayerRGGB10> : BayerLayoutOf<false, 0, 0> {};
+   template <> struct BayerLayout<PixelFormat::BayerGRBG10> : BayerLayoutOf<false, 1, 0> {};
+   template <> struct BayerLayout<PixelFormat::BayerGBRG10> : BayerLayoutOf<false, 0, 1> {};
+   template <> struct BayerLayout<PixelFormat::BayerBGGR10> : BayerLayoutOf<false, 1, 1> {};
+   template <> struct BayerLayout<PixelFormat::BayerRGGB10Packed> : BayerLayoutOf<true, 0, 0> {};
+   template <> struct BayerLayout<PixelFormat::BayerGRBG10Packed> : BayerLayoutOf<true, 1, 0> {};
+   template <> struct BayerLayout<PixelFormat::BayerGBRG10Packed> : BayerLayoutOf<true, 0, 1> {};
+   template <> struct BayerLayout<PixelFormat::BayerBGGR10Packed> : BayerLayoutOf<true, 1, 1> {};
+
+   /// <summary>
+   /// Returns the high 8 bits of a 10-bit Bayer sample
+   /// </summary>
+   template <bool Packed>
+   inline int bayerSample(const uint8_t *row, int x)
+   {
+      if constexpr (Packed)
+         return row[5 * (x >> 2) + (x & 3)];
+      else
+         return ((row[2 * x] | (row[2 * x + 1] << 8)) >> 2) & 0xFF;
+   }
+
+}
+
+// =====================================================
+//  struct DotScanResult
+// =====================================================
+
+/// <summary>
+/// Adds the given result to this one
+/// </summary>
+void DotScanResult::add(const DotScanResult &result)
+{
+   pixelsScanned += result.pixelsScanned;
+   samplesScanned += result.samplesScanned;
+   saturatedCount += result.saturatedCount;
+   hitCount += result.hitCount;
+   weightSum += result.weightSum;
+   weightedXSum += result.weightedXSum;
+   weightedYSum += result.weightedYSum;
+}
+
+
+// =====================================================
+//  class DotDetector
+// =====================================================
+
+/// <summary>
+/// Initializes a new instance of class DotDetector
+/// </summary>
+DotDetector::DotDetector(int width, int height)
+{
+   this->width = width;
+   this->height = height;
+
+   // a dot is usually a small fraction of the image; anything much larger
+   // than this is not something we're going to be able to make sense of
+   hitListCapacity = width * height / 16;
+   hitX.resize(hitListCapacity);
+   hitY.resize(hitListCapacity);
+   hitWeight.resize(hitListCapacity);
+}
+
+
+/// <summary>
+/// Clips the given window to the frame, and to the largest frame we're set up
+/// for; the frame being shorter than it claims if the buffer is too short
+/// </summary>
+ScanWindow DotDetector::clipWindow(const FrameFormat &format, ScanWindow window, int pixelDataLength) const
+{
+   int columns = std::min(format.width, width);
+   int rows = std::min(format.getRowsAvailable(pixelDataLength), height);
+   if (isBayer(format.pixelFormat))
+      columns &= ~1;
+
+   if (window.left < 0)
+      window.left = 0;
+   if (window.top < 0)
+      window.top = 0;
+   if (window.right > columns)
+      window.right = columns;
+   if (window.bottom > rows)
+      window.bottom = rows;
+   if (window.right < window.left)
+      window.right = window.left;
+   if (window.bottom < window.top)
+      window.bottom = window.top;
+   return window;
+}
+
+
+/// <summary>
+/// Scans the given window of a frame of the given format; the window is
+/// clipped to the frame
+/// </summary>
+void DotDetector::scan(const FrameFormat &format, const uint8_t *pixelData, int pixelDataLength, ScanWindow window)
+{
+   scan(format, pixelData, pixelDataLength, &window, 1);
+}
+
+
+/// <summary>
+/// Scans several windows of a frame, totalling the results as if they were
+/// one; they had better not overlap, or pixels will be counted twice
+/// </summary>
+void DotDetector::scan(const FrameFormat &format, const uint8_t *pixelData, int pixelDataLength, const ScanWindow *windows, int windowCount)
+{
+   result = DotScanResult();
+   hitsListed = 0;
+   frameFormat = format;
+
+   for (int i=0; i<windowCount; ++i)
+      scanWindow(pixelData, clipWindow(format, windows[i], pixelDataLength));
+}
+
+
+/// <summary>
+/// Scans a window that's already been clipped, adding to the results
+/// </summary>
+void DotDetector::scanWindow(const uint8_t *pixelData, const ScanWindow &window)
+{
+   const FrameFormat &format = frameFormat;
+   uint32_t pixels = window.getArea();
+   result.pixelsScanned += pixels;
+   if (pixels == 0)
+      return;
+   if (format.pixelFormat != PixelFormat::YUV420 && !isBayer(format.pixelFormat))
+      result.samplesScanned += 3 * pixels;
+
+   const uint8_t *plane = pixelData + format.planeOffset[0];
+   int stride = format.planeStride[0];
+   switch (format.pixelFormat)
+   {
+   case PixelFormat::BGR24:
+      scanPackedRows<PixelFormat::BGR24>(plane, stride, window);
+      break;
+
+   case PixelFormat::RGB24:
+      scanPackedRows<PixelFormat::RGB24>(plane, stride, window);
+      break;
+
+   case PixelFormat::XRGB8888:
+      scanPackedRows<PixelFormat::XRGB8888>(plane, stride, window);
+      break;
+
+   case PixelFormat::YUV420:
+      // the only samples we count are the luma of candidate pixels
+      scanYUV420(pixelData, window);
+      break;
+
+   case PixelFormat::BayerRGGB10:
+      scanBayer<PixelFormat::BayerRGGB10>(pixelData, window);
+      break;
+   case PixelFormat::BayerGRBG10:
+      scanBayer<PixelFormat::BayerGRBG10>(pixelData, window);
+      break;
+   case PixelFormat::BayerGBRG10:
+      scanBayer<PixelFormat::BayerGBRG10>(pixelData, window);
+      break;
+   case PixelFormat::BayerBGGR10:
+      scanBayer<PixelFormat::BayerBGGR10>(pixelData, window);
+      break;
+   case PixelFormat::BayerRGGB10Packed:
+      scanBayer<PixelFormat::BayerRGGB10Packed>(pixelData, window);
+      break;
+   case PixelFormat::BayerGRBG10Packed:
+      scanBayer<PixelFormat::BayerGRBG10Packed>(pixelData, window);
+      break;
+   case PixelFormat::BayerGBRG10Packed:
+      scanBayer<PixelFormat::BayerGBRG10Packed>(pixelData, window);
+      break;
+   case PixelFormat::BayerBGGR10Packed:
+      scanBayer<PixelFormat::BayerBGGR10Packed>(pixelData, window);
+      break;
+   }
+}
+
+
+/// <summary>
+/// Records a pixel that looks like it's part of the dot, along with how red
+/// it is, unless the background is at least as red there; hits are rare
+/// enough that this doesn't need to be vectorized
+/// </summary>
+inline void DotDetector::addHit(int x, int y, int weight)
+{
+   if (weight > 255)
+      weight = 255;
+   if (background != nullptr && weight <= background[backgroundStride * y + x])
+      return;
+   if (hitsListed < hitListCapacity)
+   {
+      hitX[hitsListed] = (uint16_t)x;
+      hitY[hitsListed] = (uint16_t)y;
+      hitWeight[hitsListed] = (uint8_t)weight;
+      ++hitsListed;
+   }
+
+   ++result.hitCount;
+   result.weightSum += weight;
+   result.weightedXSum += weight * x;
+   result.weightedYSum += weight * y;
+}
+
+
+/// <summary>
+/// Scans a window of a packed RGB frame, by the color table if we have one
+/// </summary>
+template <PixelFormat Format>
+void DotDetector::scanPackedRows(const uint8_t *plane, int stride, const ScanWindow &window)
+{
+   if (colorTable != nullptr)
+   {
+      for (int y=window.top; y<window.bottom; ++y)
+         scanPackedRow<Format, true>(plane + stride * y, y, window.left, window.right);
+   }
+   else
+   {
+      for (int y=window.top; y<window.bottom; ++y)
+         scanPackedRow<Format, false>(plane + stride * y, y, window.left, window.right);
+   }
+}
+
+
+/// <summary>
+/// Scans part of a row of packed RGB pixels.  NEON and SSSE3 builds take 16
+/// pixels at a time and leave the rest of the row to the scalar loop.
+///
+/// Pixels are classified by r > g + b, or by the color table if ByTable.  A
+/// table lookup doesn't vectorize, but working out the table indices does,
+/// so that's all that's left to do a pixel at a time.  Redness means nothing
+/// for a dot that isn't red, so the table's hits are weighted by their
+/// brightest channel instead, which falls off toward the dot's edge whatever
+/// its color.
+/// </summary>
+template <PixelFormat Format, bool ByTable>
+void DotDetector::scanPackedRow(const uint8_t *row, int y, int left, int right)
+{
+   using Layout = PackedLayout<Format>;
+   constexpr int BytesPerPixel = Layout::BytesPerPixel;
+
+   auto hitWeight = [](int r, int g, int b) {
+      if constexpr (ByTable)
+         return std::max(r, std::max(g, b));
+      else
+         return r - g - b;
+   };
+
+   // looks up 16 table indices, returning a bit for each hit
+   auto lookUp = [this](const uint16_t *indices) {
+      unsigned hits = 0;
+      for (int i=0; i<16; ++i)
+         hits |= (unsigned)colorTable->isDotIndex(indices[i]) << i;
+      return hits;
+   };
+
+   int x = left;
+
+#if defined(__ARM_NEON)
+
+   // vld3q/vld4q deinterleave 16 pixels at a time for us
+   const uint8x16_t saturated = vdupq_n_u8(255);
+   const uint8x16_t one = vdupq_n_u8(1);
+   uint16x8_t saturatedCounts = vdupq_n_u16(0);
+
+   for (; x + 16 <= right; x += 16)
+   {
+      uint8x16_t r, g, b;
+      if constexpr (BytesPerPixel == 3)
+      {
+         uint8x16x3_t v = vld3q_u8(row + 3 * x);
+         r = v.val[Layout::Red];
+         g = v.val[Layout::Green];
+         b = v.val[Layout::Blue];
+      }
+      else
+      {
+         uint8x16x4_t v = vld4q_u8(row + 4 * x);
+         r = v.val[Layout::Red];
+         g = v.val[Layout::Green];
+         b = v.val[Layout::Blue];
+      }
+
+      // count the saturated samples, at most 3 per lane per iteration
+      uint8x16_t s = vandq_u8(vceqq_u8(r, saturated), one);
+      s = vaddq_u8(s, vandq_u8(vceqq_u8(g, saturated), one));
+      s = vaddq_u8(s, vandq_u8(vceqq_u8(b, saturated), one));
+      saturatedCounts = vpadalq_u8(saturatedCounts, s);
+
+      unsigned hits;
+      if constexpr (ByTable)
+      {
+         constexpr int TableShift = 8 - ColorTable::LevelBits;
+         uint8x16_t rIndex = vshrq_n_u8(r, TableShift);
+         uint8x16_t gIndex = vshrq_n_u8(g, TableShift);
+         uint8x16_t bIndex = vshrq_n_u8(b, TableShift);
+         uint16_t indices[16];
+         vst1q_u16(indices, vorrq_u16(vorrq_u16(
+            vshlq_n_u16(vmovl_u8(vget_low_u8(rIndex)), 2 * ColorTable::LevelBits),
+            vshlq_n_u16(vmovl_u8(vget_low_u8(gIndex)), ColorTable::LevelBits)),
+            vmovl_u8(vget_low_u8(bIndex))));
+         vst1q_u16(indices + 8, vorrq_u16(vorrq_u16(
+            vshlq_n_u16(vmovl_u8(vget_high_u8(rIndex)), 2 * ColorTable::LevelBits),
+            vshlq_n_u16(vmovl_u8(vget_high_u8(gIndex)), ColorTable::LevelBits)),
+            vmovl_u8(vget_high_u8(bIndex))));
+         hits = lookUp(indices);
+      }
+      else
+      {
+         // r > b + g; saturating add is fine since r can't exceed 255 anyway
+         uint8x16_t mask = vcgtq_u8(r, vqaddq_u8(b, g));
+         uint64x2_t mask64 = vreinterpretq_u64_u8(mask);
+         hits = 0;
+         if ((vgetq_lane_u64(mask64, 0) | vgetq_lane_u64(mask64, 1)) != 0)
+         {
+            uint8_t lanes[16];
+            vst1q_u8(lanes, mask);
+            for (int i=0; i<16; ++i)
+               hits |= (unsigned)(lanes[i] & 1) << i;
+         }
+      }
+
+      while (hits != 0)
+      {
+         int xHit = x + __builtin_ctz(hits);
+         const uint8_t *hit = row + BytesPerPixel * xHit;
+         addHit(xHit, y, hitWeight(hit[Layout::Red], hit[Layout::Green], hit[Layout::Blue]));
+         hits &= hits - 1;
+      }
+   }
+
+   uint64x2_t total = vpaddlq_u32(vpaddlq_u16(saturatedCounts));
+   result.saturatedCount += (uint32_t)(vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1));
+
+#elif defined(__SSSE3__)
+
+   // pshufb does the deinterleaving of 16 pixels from 3 or 4 loads
+   static constexpr ChannelShuffle redShuffle = makeChannelShuffle(BytesPerPixel, Layout::Red);
+   static constexpr ChannelShuffle greenShuffle = makeChannelShuffle(BytesPerPixel, Layout::Green);
+   static constexpr ChannelShuffle blueShuffle = makeChannelShuffle(BytesPerPixel, Layout::Blue);
+   const __m128i saturated = _mm_set1_epi8(-1);
+   const __m128i zero = _mm_setzero_si128();
+
+   // byte counters of saturated samples; each iteration adds at most 3 to a
+   // lane, so we flush them to the total before they can overflow
+   __m128i saturatedCounts = zero;
+   int iterationsUntilFlush = 80;
+
+   for (; x + 16 <= right; x += 16)
+   {
+      const __m128i *p = (const __m128i *)(row + BytesPerPixel * x);
+      __m128i v[BytesPerPixel];
+      for (int load=0; load<BytesPerPixel; ++load)
+         v[load] = _mm_loadu_si128(p + load);
+
+      __m128i r = gatherChannel<BytesPerPixel>(v, redShuffle);
+      __m128i g = gatherChannel<BytesPerPixel>(v, greenShuffle);
+      __m128i b = gatherChannel<BytesPerPixel>(v, blueShuffle);
+
+      // count saturation on the separated channels so that padding bytes
+      // don't get counted
+      saturatedCounts = _mm_sub_epi8(saturatedCounts, _mm_cmpeq_epi8(r, saturated));
+      saturatedCounts = _mm_sub_epi8(saturatedCounts, _mm_cmpeq_epi8(g, saturated));
+      saturatedCounts = _mm_sub_epi8(saturatedCounts, _mm_cmpeq_epi8(b, saturated));
+      if (--iterationsUntilFlush == 0)
+      {
+         __m128i sums = _mm_sad_epu8(saturatedCounts, zero);
+         result.saturatedCount += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+         saturatedCounts = zero;
+         iterationsUntilFlush = 80;
+      }
+
+      unsigned hits;
+      if constexpr (ByTable)
+      {
+         // there are no byte shifts, so the indices are put together 16 bits
+         // at a time from the top bits of each channel
+         constexpr int TableShift = 8 - ColorTable::LevelBits;
+         const __m128i levelMask = _mm_set1_epi16((0xFF << TableShift) & 0xFF);
+         auto indices = [&](__m128i r16, __m128i g16, __m128i b16) {
+            __m128i index = _mm_slli_epi16(_mm_and_si128(r16, levelMask), 2 * ColorTable::LevelBits - TableShift);
+            index = _mm_or_si128(index, _mm_slli_epi16(_mm_and_si128(g16, levelMask), ColorTable::LevelBits - TableShift));
+            return _mm_or_si128(index, _mm_srli_epi16(b16, TableShift));
+         };
+         uint16_t lanes[16];
+         _mm_storeu_si128((__m128i *)lanes, indices(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero)));
+         _mm_storeu_si128((__m128i *)(lanes + 8), indices(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero)));
+         hits = lookUp(lanes);
+      }
+      else
+      {
+         // r > b + g; there's no unsigned compare, but r - (b + g) saturates
+         // to zero exactly when it fails
+         __m128i misses = _mm_cmpeq_epi8(_mm_subs_epu8(r, _mm_adds_epu8(b, g)), zero);
+         hits = ~(unsigned)_mm_movemask_epi8(misses) & 0xFFFF;
+      }
+
+      while (hits != 0)
+      {
+         int xHit = x + __builtin_ctz(hits);
+         const uint8_t *hit = row + BytesPerPixel * xHit;
+         addHit(xHit, y, hitWeight(hit[Layout::Red], hit[Layout::Green], hit[Layout::Blue]));
+         hits &= hits - 1;
+      }
+   }
+
+   __m128i sums = _mm_sad_epu8(saturatedCounts, zero);
+   result.saturatedCount += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+
+#endif
+
+   // whatever is left over, or everything if we have no vector support
+   for (; x < right; ++x)
+   {
+      const uint8_t *p = row + BytesPerPixel * x;
+      int r = p[Layout::Red];
+      int g = p[Layout::Green];
+      int b = p[Layout::Blue];
+      result.saturatedCount += (r == 255) + (g == 255) + (b == 255);
+
+      bool hit;
+      if constexpr (ByTable)
+         hit = colorTable->isDot(r, g, b);
+      else
+         hit = r > b + g;
+      if (hit)
+         addHit(x, y, hitWeight(r, g, b));
+   }
+
+   (void)lookUp;
+}
+
+
+/// <summary>
+/// Scans a window of a planar YUV420 frame, reading only the V plane unless
+/// we find candidates
+/// </summary>
+void DotDetector::scanYUV420(const uint8_t *pixelData, const ScanWindow &window)
+{
+   const uint8_t *vPlane = pixelData + frameFormat.planeOffset[2];
+   int vStride = frameFormat.planeStride[2];
+
+   // the chroma samples that cover the window
+   int left = window.left / 2;
+   int right = (window.right + 1) / 2;
+   int top = window.top / 2;
+   int bottom = (window.bottom + 1) / 2;
+
+#if defined(__ARM_NEON)
+   const uint8x16_t threshold = vdupq_n_u8(128 + ChromaThreshold);
+#elif defined(__SSSE3__)
+   const __m128i threshold = _mm_set1_epi8((char)(128 + ChromaThreshold));
+   const __m128i zero = _mm_setzero_si128();
+#endif
+
+   for (int chromaY=top; chromaY<bottom; ++chromaY)
+   {
+      const uint8_t *vRow = vPlane + vStride * chromaY;
+      int chromaX = left;
+
+#if defined(__ARM_NEON)
+      for (; chromaX + 16 <= right; chromaX += 16)
+      {
+         uint8x16_t candidates = vcgtq_u8(vld1q_u8(vRow + chromaX), threshold);
+         uint64x2_t candidates64 = vreinterpretq_u64_u8(candidates);
+         if ((vgetq_lane_u64(candidates64, 0) | vgetq_lane_u64(candidates64, 1)) != 0)
+         {
+            uint8_t mask[16];
+            vst1q_u8(mask, candidates);
+            for (int i=0; i<16; ++i)
+               if (mask[i])
+                  addChromaCandidate(pixelData, window, chromaX + i, chromaY, vRow[chromaX + i]);
+         }
+      }
+#elif defined(__SSSE3__)
+      for (; chromaX + 16 <= right; chromaX += 16)
+      {
+         // v > threshold, unsigned, as in the packed kernels
+         __m128i v = _mm_loadu_si128((const __m128i *)(vRow + chromaX));
+         __m128i misses = _mm_cmpeq_epi8(_mm_subs_epu8(v, threshold), zero);
+         unsigned candidates = ~(unsigned)_mm_movemask_epi8(misses) & 0xFFFF;
+         while (candidates != 0)
+         {
+            int xCandidate = chromaX + __builtin_ctz(candidates);
+            addChromaCandidate(pixelData, window, xCandidate, chromaY, vRow[xCandidate]);
+            candidates &= candidates - 1;
+         }
+      }
+#endif
+
+      for (; chromaX < right; ++chromaX)
+         if (vRow[chromaX] > 128 + ChromaThreshold)
+            addChromaCandidate(pixelData, window, chromaX, chromaY, vRow[chromaX]);
+   }
+}
+
+
+/// <summary>
+/// Turns a candidate chroma sample into hits for the pixels of its 2x2 block
+/// that lie in the window.  With luma checking each pixel has to pass
+/// r > g + b, which converting from BT.601 (full range) works out to
+/// 2.116V - 1.428U > Y with U and V centered on zero; without it every pixel
+/// of the block is a hit, weighted by how far V is past the threshold.
+/// </summary>
+void DotDetector::addChromaCandidate(const uint8_t *pixelData, const ScanWindow &window, int chromaX, int chromaY, int v)
+{
+   v -= 128;
+   if (!lumaCheck)
+   {
+      addBlockHits(window, chromaX, chromaY, v - ChromaThreshold);
+      return;
+   }
+
+   int left = std::max(2 * chromaX, window.left);
+   int right = std::min(2 * chromaX + 2, window.right);
+   int top = std::max(2 * chromaY, window.top);
+   int bottom = std::min(2 * chromaY + 2, window.bottom);
+   const uint8_t *yPlane = pixelData + frameFormat.planeOffset[0];
+   int yStride = frameFormat.planeStride[0];
+   int u = pixelData[frameFormat.planeOffset[1] + frameFormat.planeStride[1] * chromaY + chromaX] - 128;
+   int chromaRedness = (542 * v - 366 * u) >> 8;
+   for (int y=top; y<bottom; ++y)
+   {
+      for (int x=left; x<right; ++x)
+      {
+         int luma = yPlane[yStride * y + x];
+         ++result.samplesScanned;
+         result.saturatedCount += (luma == 255);
+
+         int redness = chromaRedness - luma;
+         if (redness > 0)
+            addHit(x, y, redness);
+      }
+   }
+}
+
+
+/// <summary>
+/// Scans a window of a raw Bayer frame a 2x2 cell at a time
+/// </summary>
+template <PixelFormat Format>
+void DotDetector::scanBayer(const uint8_t *pixelData, const ScanWindow &window)
+{
+   using Layout = BayerLayout<Format>;
+   const uint8_t *plane = pixelData + frameFormat.planeOffset[0];
+   int stride = frameFormat.planeStride[0];
+
+   // the cells that cover the window
+   int left = window.left / 2;
+   int right = (window.right + 1) / 2;
+   int top = window.top / 2;
+   int bottom = (window.bottom + 1) / 2;
+   result.samplesScanned += 4 * (right - left) * (bottom - top);
+
+   for (int cellY=top; cellY<bottom; ++cellY)
+   {
+      const uint8_t *redRow = plane + stride * (2 * cellY + Layout::RedY);
+      const uint8_t *blueRow = plane + stride * (2 * cellY + 1 - Layout::RedY);
+      for (int cellX=left; cellX<right; ++cellX)
+      {
+         int r = bayerSample<Layout::Packed>(redRow, 2 * cellX + Layout::RedX);
+         int g1 = bayerSample<Layout::Packed>(redRow, 2 * cellX + 1 - Layout::RedX);
+         int g2 = bayerSample<Layout::Packed>(blueRow, 2 * cellX + Layout::RedX);
+         int b = bayerSample<Layout::Packed>(blueRow, 2 * cellX + 1 - Layout::RedX);
+         result.saturatedCount += (r == 255) + (g1 == 255) + (g2 == 255) + (b == 255);
+
+         int redness = r - (g1 + g2) / 2 - b;
+         if (redness > 0)
+            addBlockHits(window, cellX, cellY, redness);
+      }
+   }
+}
+
+
+/// <summary>
+/// Adds a hit of the given weight for each pixel of a 2x2 block that lies in
+/// the window, for the kernels that work at half resolution
+/// </summary>
+void DotDetector::addBlockHits(const ScanWindow &window, int blockX, int blockY, int weight)
+{
+   int left = std::max(2 * blockX, window.left);
+   int right = std::min(2 * blockX + 2, window.right);
+   int top = std::max(2 * blockY, window.top);
+   int bottom = std::min(2 * blockY + 2, window.bottom);
+   for (int y=top; y<bottom; ++y)
+      for (int x=left; x<right; ++x)
+         addHit(x, y, weight);
+}
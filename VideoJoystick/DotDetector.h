@@ -0,0 +1,151 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef DOTDETECTOR_H
+#define DOTDETECTOR_H
+
+#include <stdint.h>
+#include <vector>
+#include "ColorTable.h"
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// Rectangle of pixels to scan; right and bottom are exclusive
+/// </summary>
+struct ScanWindow {
+   int left = 0;
+   int top = 0;
+   int right = 0;
+   int bottom = 0;
+
+   ScanWindow() = default;
+   ScanWindow(int _left, int _top, int _right, int _bottom) : left(_left), top(_top), right(_right), bottom(_bottom) {}
+
+   int getArea() const { return (right - left) * (bottom - top); }
+};
+
+
+/// <summary>
+/// Totals from scanning a frame for the red dot
+/// </summary>
+struct DotScanResult {
+   uint32_t pixelsScanned = 0;
+   uint32_t samplesScanned = 0;
+   uint32_t saturatedCount = 0;
+   uint32_t hitCount = 0;
+
+   // redness-weighted moments of the hits, redness being r - (b + g); hits
+   // found by a color table are weighted by their brightest channel instead
+   uint64_t weightSum = 0;
+   uint64_t weightedXSum = 0;
+   uint64_t weightedYSum = 0;
+
+   void add(const DotScanResult &result);
+};
+
+
+/// <summary>
+/// Classifies every pixel of a frame as red dot or not.  A pixel is considered
+/// part of the dot if r > b + g; while we're at it we count saturated samples
+/// (any color channel at 255) in the same pass.
+///
+/// There's a kernel for each pixel format, specialized at compile time for its
+/// byte order, so that we can't get red and blue mixed up and don't pay for
+/// figuring out which is which per pixel.  The packed RGB kernels are
+/// vectorized with NEON on the Pi and SSSE3 on x86, which the project files
+/// ask for in SIMD_FLAGS; anything else gets the scalar version.
+///
+/// YUV420 frames are scanned by their quarter resolution V plane alone, which
+/// is a twelfth of the bytes of a packed RGB frame.  Any chroma sample redder
+/// than ChromaThreshold makes its 2x2 block of pixels candidates; with luma
+/// checking on, each candidate is confirmed against the full r > g + b rule
+/// using its own luma (and its block's U), and those luma samples are the
+/// only ones counted for saturation.
+///
+/// Packed RGB frames can be classified by a ColorTable instead, for a dot
+/// that isn't red or a background that needs a fussier rule; everything but
+/// the table lookups themselves is still vectorized.
+///
+/// Hits can be checked against a background, so that things that look like
+/// the dot but never move can be ignored; only hits pay for that.
+///
+/// Raw Bayer frames skip the ISP entirely.  Each 2x2 cell of photosites is
+/// treated as one pixel of its red, average green and blue (the high 8 bits
+/// of each, without white balance), and if it passes r > g + b all four of
+/// its pixels are hits.
+/// </summary>
+class DotDetector
+{
+public:
+   DotDetector(int width, int height);
+
+   int getWidth() const { return width; }
+   int getHeight() const { return height; }
+
+   ScanWindow clipWindow(const FrameFormat &format, ScanWindow window, int pixelDataLength) const;
+   void scan(const FrameFormat &format, const uint8_t *pixelData, int pixelDataLength, ScanWindow window);
+   void scan(const FrameFormat &format, const uint8_t *pixelData, int pixelDataLength, const ScanWindow *windows, int windowCount);
+
+   bool getLumaCheck() const { return lumaCheck; }
+   void setLumaCheck(bool check) { lumaCheck = check; }
+
+   // the table to classify packed RGB pixels by, or null for r > g + b; the
+   // table has to outlive any scan that uses it
+   const ColorTable *getColorTable() const { return colorTable; }
+   void setColorTable(const ColorTable *table) { colorTable = table; }
+
+   // a plane of the weight a hit has to beat at each pixel, or null for
+   // none; see BackgroundModel
+   void setBackground(const uint8_t *plane, int stride) { background = plane; backgroundStride = stride; }
+
+   const DotScanResult &getResult() const { return result; }
+
+   // the hit list; if there are more hits than it has room for then only the
+   // first ones are listed, though all of them are in the result totals
+   uint32_t getHitListCapacity() const { return hitListCapacity; }
+   uint32_t getHitsListed() const { return hitsListed; }
+   bool isHitListFull() const { return hitsListed < result.hitCount; }
+   const uint16_t *getHitX() const { return &hitX[0]; }
+   const uint16_t *getHitY() const { return &hitY[0]; }
+   const uint8_t *getHitWeight() const { return &hitWeight[0]; }
+
+private:
+   // how far above neutral (128) V has to be for a pixel to be a candidate
+   static constexpr int ChromaThreshold = 16;
+
+private:
+   void scanWindow(const uint8_t *pixelData, const ScanWindow &window);
+   template <PixelFormat Format> void scanPackedRows(const uint8_t *plane, int stride, const ScanWindow &window);
+   template <PixelFormat Format, bool ByTable> void scanPackedRow(const uint8_t *row, int y, int left, int right);
+   void scanYUV420(const uint8_t *pixelData, const ScanWindow &window);
+   void addChromaCandidate(const uint8_t *pixelData, const ScanWindow &window, int chromaX, int chromaY, int v);
+   template <PixelFormat Format> void scanBayer(const uint8_t *pixelData, const ScanWindow &window);
+   void addBlockHits(const ScanWindow &window, int blockX, int blockY, int weight);
+   void addHit(int x, int y, int weight);
+
+private:
+   // the largest frame we're set up for; anything beyond it is ignored
+   int width;
+   int height;
+   bool lumaCheck = true;
+   const ColorTable *colorTable = nullptr;
+   const uint8_t *background = nullptr;
+   int backgroundStride = 0;
+   FrameFormat frameFormat;
+   DotScanResult result;
+
+   // allocated once at construction and never resized, so that scanning a
+   // frame never touches the heap
+   uint32_t hitsListed = 0;
+   uint32_t hitListCapacity;
+   std::vector<uint16_t> hitX;
+   std::vector<uint16_t> hitY;
+   std::vector<uint8_t> hitWeight;
+};
+
+
+#endif
@@ -0,0 +1,162 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include "CaptureFile.h"
+#include "FileFrameGrabber.h"
+
+
+/// <summary>
+/// A frame whose pixels are in a capture file's mapping
+/// </summary>
+class CapturedVideoFrame : public VideoFrame {
+public:
+   CapturedVideoFrame(const std::shared_ptr<const void> &_mapping, const uint8_t *_pixelData, int _pixelDataLength)
+      : mapping(_mapping), pixelData(_pixelData), pixelDataLength(_pixelDataLength) {}
+
+   int getPixelDataLength() const override { return pixelDataLength; }
+   const uint8_t *getPixelData() const override { return pixelData; }
+
+private:
+   std::shared_ptr<const void> mapping;
+   const uint8_t *pixelData;
+   int pixelDataLength;
+};
+
+
+/// <summary>
+/// Initializes a new instance of class FileFrameGrabber, mapping the file
+/// and finding the frames in it; fails if it isn't a capture file
+/// </summary>
+FileFrameGrabber::FileFrameGrabber(const std::filesystem::path &path, Pacing pacing)
+   : pacing(pacing)
+{
+   int fd = open(path.c_str(), O_RDONLY);
+   if (fd == -1)
+      throw std::runtime_error("FileFrameGrabber: can't open " + path.string());
+
+   struct stat status;
+   if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(CaptureFileHeader))
+   {
+      close(fd);
+      throw std::runtime_error("FileFrameGrabber: not a capture file: " + path.string());
+   }
+
+   mapping = std::make_shared<Mapping>();
+   mapping->length = (size_t)status.st_size;
+   void *data = mmap(nullptr, mapping->length, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED)
+      throw std::runtime_error("FileFrameGrabber: mmap failed: " + path.string());
+   mapping->data = (const uint8_t *)data;
+   madvise(data, mapping->length, MADV_SEQUENTIAL);
+
+   CaptureFileHeader fileHeader;
+   memcpy(&fileHeader, mapping->data, sizeof(fileHeader));
+   if (!fileHeader.isValid())
+      throw std::runtime_error("FileFrameGrabber: not a capture file: " + path.string());
+   format = fileHeader.getFormat();
+
+   // index the frames; a frame cut short by the end of the file (say the
+   // recording was interrupted) is left out
+   size_t offset = fileHeader.headerSize;
+   while (offset + sizeof(CaptureFrameHeader) <= mapping->length)
+   {
+      CaptureFrameHeader frameHeader;
+      memcpy(&frameHeader, mapping->data + offset, sizeof(frameHeader));
+      offset += sizeof(frameHeader);
+      if (offset + frameHeader.length > mapping->length)
+         break;
+
+      FrameEntry entry;
+      entry.timestamp = frameHeader.timestamp;
+      entry.sequence = frameHeader.sequence;
+      entry.pixelData = mapping->data + offset;
+      entry.pixelDataLength = (int)frameHeader.length;
+      frames.push_back(entry);
+
+      offset += CaptureFileHeader::getPaddedLength(frameHeader.length);
+   }
+}
+
+
+/// <summary>
+/// Releases resources held by the object
+/// </summary>
+FileFrameGrabber::~FileFrameGrabber()
+{
+   terminated = true;
+   if (replayThread.joinable())
+      replayThread.join();
+}
+
+
+/// <summary>
+/// Unmaps the file
+/// </summary>
+FileFrameGrabber::Mapping::~Mapping()
+{
+   if (data != nullptr)
+      munmap(const_cast<uint8_t *>(data), length);
+}
+
+
+/// <summary>
+/// Starts delivering frames to the callback
+/// </summary>
+void FileFrameGrabber::startCapturing()
+{
+   if (replayThread.joinable())
+      return;
+   replayThread = std::thread([this]() { replayFrames(); });
+}
+
+
+/// <summary>
+/// Thread that delivers the frames
+/// </summary>
+void FileFrameGrabber::replayFrames()
+{
+   auto start = std::chrono::steady_clock::now();
+   uint64_t firstTimestamp = frames.empty() ? 0 : frames[0].timestamp;
+
+   for (size_t i=0; i<frames.size() && !terminated; ++i)
+   {
+      const FrameEntry &entry = frames[i];
+
+      // wait until it's time, a bit at a time so that we notice if we're
+      // told to quit; frames without timestamps, or that are out of order, go
+      // right away
+      if (pacing == Pacing::Recorded && entry.timestamp > firstTimestamp)
+      {
+         auto due = start + std::chrono::nanoseconds(entry.timestamp - firstTimestamp);
+         while (!terminated && std::chrono::steady_clock::now() < due)
+            std::this_thread::sleep_until(std::min(due, std::chrono::steady_clock::now() + std::chrono::milliseconds(100)));
+      }
+
+      auto frame = std::make_shared<CapturedVideoFrame>(mapping, entry.pixelData, entry.pixelDataLength);
+      frame->setFormat(format);
+      frame->setSequence(i);
+      frame->setCameraSequence(entry.sequence);
+      uint64_t now = VideoFrame::getCurrentTimestamp();
+      frame->setTimestamp(now);
+      frame->setCompletionTimestamp(now);
+      frame->setHandoffTimestamp(now);
+
+      ++framesProcessed;
+      if (frameCallback)
+         frameCallback(frame);
+   }
+
+   finished = true;
+}
@@ -0,0 +1,87 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef FILEFRAMEGRABBER_H
+#define FILEFRAMEGRABBER_H
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "FrameGrabber.h"
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// FrameGrabber that replays a capture file written by FrameRecorder, so
+/// that we can work on real footage with no camera attached.  The file is
+/// memory mapped and frames point straight into it.  Frames are delivered on
+/// a thread of our own, either spaced out the way they were recorded or as
+/// fast as the callback takes them.
+///
+/// Frames keep their recorded camera sequence numbers, so gaps in the
+/// recording show up as missed frames, but they're timestamped as they're
+/// delivered since the recorded times are long gone.
+/// </summary>
+class FileFrameGrabber : public FrameGrabber
+{
+public:
+   enum class Pacing {
+      Recorded,
+      AsFastAsPossible
+   };
+
+public:
+   FileFrameGrabber(const std::filesystem::path &path, Pacing pacing = Pacing::Recorded);
+   virtual ~FileFrameGrabber();
+
+   void SetupFrameCallback(const std::function<void(const std::shared_ptr<VideoFrame> &)> &callback) override { frameCallback = callback; }
+   void startCapturing() override;
+   bool isFinished() const override { return finished; }
+
+   uint64_t getFramesProcessed() const override { return framesProcessed; }
+
+   const FrameFormat &getFormat() const { return format; }
+   int getFrameCount() const { return (int)frames.size(); }
+
+private:
+   /// <summary>
+   /// The file's mapping, which frames share so that it stays put for as
+   /// long as anyone is holding one
+   /// </summary>
+   struct Mapping {
+      const uint8_t *data = nullptr;
+      size_t length = 0;
+      ~Mapping();
+   };
+
+   struct FrameEntry {
+      uint64_t timestamp;
+      uint64_t sequence;
+      const uint8_t *pixelData;
+      int pixelDataLength;
+   };
+
+private:
+   void replayFrames();
+
+private:
+   Pacing pacing;
+   std::shared_ptr<Mapping> mapping;
+   FrameFormat format;
+   std::vector<FrameEntry> frames;
+
+   std::function<void(const std::shared_ptr<VideoFrame> &)> frameCallback;
+   std::thread replayThread;
+   std::atomic<bool> terminated { false };
+   std::atomic<bool> finished { false };
+   std::atomic<uint64_t> framesProcessed { 0 };
+};
+
+
+#endif
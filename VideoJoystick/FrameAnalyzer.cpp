@@ -0,0 +1,382 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <algorithm>
+#include "FrameAnalyzer.h"
+
+
+/// <summary>
+/// Initializes a new instance of class FrameAnalyzer
+/// </summary>
+FrameAnalyzer::FrameAnalyzer(int width, int height, int stripeCount)
+   : coarseScanner(width, height), blobLabeller(width, height)
+{
+   this->width = width;
+   this->height = height;
+   if (stripeCount < 1)
+      stripeCount = 1;
+
+   // each stripe gets a detector with a hit list big enough for the whole
+   // frame, since the dot may well be entirely in one stripe, and likewise
+   // profiles
+   for (int i=0; i<stripeCount; ++i)
+   {
+      detectors.emplace_back(new DotDetector(width, height));
+      profileDetectors.emplace_back(new ProfileDetector(width, height));
+   }
+   stripeWindows.resize(stripeCount);
+   stripeWorkers.reset(new StripeWorkerPool(stripeCount, [this](int stripe) { scanStripe(stripe); }));
+
+   // allocate all of our scratch space now so that we don't have to
+   // while processing frames
+   columnHistogram.resize(width);
+   rowHistogram.resize(height);
+   distanceScratch.resize(stripeCount * detectors[0]->getHitListCapacity());
+   columnProfile.resize(width);
+   rowProfile.resize(height);
+}
+
+
+/// <summary>
+/// Returns the index of the median of the values counted by the histogram
+/// </summary>
+static int medianFromHistogram(const uint32_t *histogram, int size, uint32_t count)
+{
+   uint32_t total = 0;
+   for (int i=0; i<size; ++i)
+   {
+      total += histogram[i];
+      if (total > count / 2)
+         return i;
+   }
+   return size - 1;
+}
+
+
+/// <summary>
+/// Calculates the position of the dot from the hits of the latest scan.  The
+/// scan gives us redness-weighted sums of all the hits, which would be all we
+/// need if there were never any stray red pixels.  So we take the median as a
+/// position that wild data points can't drag around, throw out hits that are
+/// much further from it than most, and take the weighted centroid of what's
+/// left; that gives us sub-pixel resolution.  Everything here works out of
+/// scratch space that we allocated up front.  A profile scan has no hits, so
+/// it gets located by its profiles instead.
+/// </summary>
+bool FrameAnalyzer::locateDot(float &x, float &y)
+{
+   if (scanResult.hitCount == 0)
+      return false;
+   if (profileScan)
+      return locateDotFromProfiles(x, y);
+
+   // if there's so much red that a hit list overflowed there's no point
+   // in trying to be clever
+   if (isAnyHitListFull())
+   {
+      x = (float)((double)scanResult.weightedXSum / scanResult.weightSum);
+      y = (float)((double)scanResult.weightedYSum / scanResult.weightSum);
+      return true;
+   }
+
+   // the median, by way of histograms so that it's O(n)
+   std::fill(columnHistogram.begin(), columnHistogram.end(), 0);
+   std::fill(rowHistogram.begin(), rowHistogram.end(), 0);
+   for (int stripe=0; stripe<activeStripes; ++stripe)
+   {
+      const DotDetector &detector = *detectors[stripe];
+      const uint16_t *hitX = detector.getHitX();
+      const uint16_t *hitY = detector.getHitY();
+      for (uint32_t i=0; i<detector.getHitsListed(); ++i)
+      {
+         ++columnHistogram[hitX[i]];
+         ++rowHistogram[hitY[i]];
+      }
+   }
+   uint32_t hitCount = scanResult.hitCount;
+   int medianX = medianFromHistogram(&columnHistogram[0], width, hitCount);
+   int medianY = medianFromHistogram(&rowHistogram[0], height, hitCount);
+
+   // the median squared distance from the median; hits more than a few times
+   // further away than that are outliers
+   uint32_t n = 0;
+   for (int stripe=0; stripe<activeStripes; ++stripe)
+   {
+      const DotDetector &detector = *detectors[stripe];
+      const uint16_t *hitX = detector.getHitX();
+      const uint16_t *hitY = detector.getHitY();
+      for (uint32_t i=0; i<detector.getHitsListed(); ++i)
+      {
+         int dx = hitX[i] - medianX;
+         int dy = hitY[i] - medianY;
+         distanceScratch[n++] = dx*dx + dy*dy;
+      }
+   }
+   std::nth_element(&distanceScratch[0], &distanceScratch[hitCount / 2], &distanceScratch[hitCount]);
+   int gate = OutlierDistanceFactor * OutlierDistanceFactor * distanceScratch[hitCount / 2];
+   if (gate < MinimumOutlierDistance * MinimumOutlierDistance)
+      gate = MinimumOutlierDistance * MinimumOutlierDistance;
+
+   // subtract the outliers from the totals
+   uint64_t weightSum = scanResult.weightSum;
+   uint64_t weightedXSum = scanResult.weightedXSum;
+   uint64_t weightedYSum = scanResult.weightedYSum;
+   for (int stripe=0; stripe<activeStripes; ++stripe)
+   {
+      const DotDetector &detector = *detectors[stripe];
+      const uint16_t *hitX = detector.getHitX();
+      const uint16_t *hitY = detector.getHitY();
+      const uint8_t *hitWeight = detector.getHitWeight();
+      for (uint32_t i=0; i<detector.getHitsListed(); ++i)
+      {
+         int dx = hitX[i] - medianX;
+         int dy = hitY[i] - medianY;
+         if (dx*dx + dy*dy > gate)
+         {
+            weightSum -= hitWeight[i];
+            weightedXSum -= (uint64_t)hitWeight[i] * hitX[i];
+            weightedYSum -= (uint64_t)hitWeight[i] * hitY[i];
+         }
+      }
+   }
+
+   // at least half the hits are within the gate, so this can't be zero
+   x = (float)((double)weightedXSum / weightSum);
+   y = (float)((double)weightedYSum / weightSum);
+   return true;
+}
+
+
+/// <summary>
+/// Calculates the position of the dot as the centroid of one of the blobs of
+/// hits of the latest scan, chosen by the given policy; see BlobLabeller.
+/// Where the blobs can't be had, because it was a profile scan, a hit list
+/// overflowed or there were too many blobs to label, we fall back on
+/// locateDot.
+/// </summary>
+bool FrameAnalyzer::locateBlob(BlobPolicy policy, bool haveExpected, float expectedX, float expectedY, float &x, float &y)
+{
+   if (scanResult.hitCount == 0)
+      return false;
+   if (profileScan || isAnyHitListFull())
+      return locateDot(x, y);
+
+   for (int stripe=0; stripe<activeStripes; ++stripe)
+   {
+      const DotDetector &detector = *detectors[stripe];
+      blobLabeller.addHits(detector.getHitX(), detector.getHitY(), detector.getHitWeight(), detector.getHitsListed());
+   }
+   if (!blobLabeller.label())
+      return locateDot(x, y);
+
+   const Blob *blob = blobLabeller.selectBlob(policy, haveExpected, expectedX, expectedY);
+   if (blob == nullptr)
+      return false;
+   x = blob->getX();
+   y = blob->getY();
+   return true;
+}
+
+
+/// <summary>
+/// Returns true if any of the active stripes found more hits than it could
+/// list
+/// </summary>
+bool FrameAnalyzer::isAnyHitListFull() const
+{
+   for (int stripe=0; stripe<activeStripes; ++stripe)
+      if (detectors[stripe]->isHitListFull())
+         return true;
+   return false;
+}
+
+
+/// <summary>
+/// Sets whether candidates found in the chroma of YUV frames get checked
+/// against their luma; see DotDetector
+/// </summary>
+void FrameAnalyzer::setLumaCheck(bool check)
+{
+   for (auto &detector : detectors)
+      detector->setLumaCheck(check);
+}
+
+
+/// <summary>
+/// Sets the color table that packed RGB pixels are classified by, or null for
+/// r > g + b.  The coarse pass of a pyramid scan and the profile scan only
+/// know about red, so with a table those fall back on scanFrame.
+/// </summary>
+void FrameAnalyzer::setColorTable(const std::shared_ptr<const ColorTable> &table)
+{
+   if (table == colorTable)
+      return;
+   colorTable = table;
+   for (auto &detector : detectors)
+      detector->setColorTable(colorTable.get());
+}
+
+
+/// <summary>
+/// Sets the background plane that hits are checked against, or null for
+/// none; see BackgroundModel.  The plane has to stay put while we're
+/// scanning.  It's only hits that get checked, so the profile scan can't
+/// use it.
+/// </summary>
+void FrameAnalyzer::setBackground(const uint8_t *plane, int stride)
+{
+   haveBackground = plane != nullptr;
+   for (auto &detector : detectors)
+      detector->setBackground(plane, stride);
+}
+
+
+/// <summary>
+/// Scans the given window of the frame for hits, splitting it into stripes
+/// if it's big enough to be worth it; the combined totals end up in
+/// scanResult, the hits in the hit lists of the active stripes' detectors.
+/// </summary>
+void FrameAnalyzer::scanFrame(const VideoFrame &frame, ScanWindow window)
+{
+   stripeFrameFormat = frame.getFormat();
+   stripePixelData = frame.getPixelData();
+   stripePixelDataLength = frame.getPixelDataLength();
+   window = detectors[0]->clipWindow(stripeFrameFormat, window, stripePixelDataLength);
+   profileScan = false;
+   divideIntoStripes(window);
+
+   stripeWorkers->run(activeStripes);
+
+   // each stripe has its own totals, so there's nothing to lock
+   scanResult = DotScanResult();
+   for (int stripe=0; stripe<activeStripes; ++stripe)
+      scanResult.add(detectors[stripe]->getResult());
+}
+
+
+/// <summary>
+/// Divides the window into stripes of whole rows, as many as it's worth
+/// having; the boundaries fall on even rows so that no stripe splits the 2x2
+/// blocks of subsampled formats
+/// </summary>
+void FrameAnalyzer::divideIntoStripes(const ScanWindow &window)
+{
+   int rows = window.bottom - window.top;
+   activeStripes = std::min(stripeWorkers->getStripeCount(), window.getArea() / MinimumStripePixels);
+   activeStripes = std::max(1, std::min(activeStripes, rows / 2));
+   for (int stripe=0; stripe<activeStripes; ++stripe)
+   {
+      stripeWindows[stripe] = window;
+      if (stripe > 0)
+         stripeWindows[stripe].top = (window.top + rows * stripe / activeStripes) & ~1;
+      if (stripe < activeStripes - 1)
+         stripeWindows[stripe].bottom = (window.top + rows * (stripe + 1) / activeStripes) & ~1;
+   }
+}
+
+
+/// <summary>
+/// Scans the given window of the frame coarse to fine: a pass over blocks of
+/// the given size finds the places the dot could be, and only those get
+/// scanned at full resolution, by a single detector since they're small.  If
+/// the format isn't one CoarseScanner handles, the window is too small to
+/// bother, there are too many candidates or we have a color table, we fall
+/// back on scanFrame.  A background doesn't matter to the coarse pass, since
+/// the full resolution scan checks its hits against it.
+/// </summary>
+void FrameAnalyzer::scanFramePyramid(const VideoFrame &frame, ScanWindow window, int blockSize)
+{
+   const FrameFormat &format = frame.getFormat();
+   window = detectors[0]->clipWindow(format, window, frame.getPixelDataLength());
+   if (colorTable || !CoarseScanner::isFormatSupported(format.pixelFormat) || window.getArea() < MinimumPyramidPixels)
+   {
+      scanFrame(frame, window);
+      return;
+   }
+
+   int regionCount = coarseScanner.findRegions(format, frame.getPixelData(), window, blockSize);
+   if (regionCount < 0)
+   {
+      scanFrame(frame, window);
+      return;
+   }
+
+   activeStripes = 1;
+   profileScan = false;
+   detectors[0]->scan(format, frame.getPixelData(), frame.getPixelDataLength(), coarseScanner.getRegions(), regionCount);
+   scanResult = detectors[0]->getResult();
+}
+
+
+/// <summary>
+/// Scans the given window of the frame for row and column redness profiles,
+/// split into stripes the same as scanFrame; locateDot then goes by the peaks
+/// of the profiles rather than by the hits.  If the format isn't one
+/// ProfileDetector handles or we have a color table or a background we fall
+/// back on scanFrame.
+/// </summary>
+void FrameAnalyzer::scanFrameProfiles(const VideoFrame &frame, ScanWindow window)
+{
+   if (colorTable || haveBackground || !ProfileDetector::isFormatSupported(frame.getFormat().pixelFormat))
+   {
+      scanFrame(frame, window);
+      return;
+   }
+
+   stripeFrameFormat = frame.getFormat();
+   stripePixelData = frame.getPixelData();
+   stripePixelDataLength = frame.getPixelDataLength();
+   window = detectors[0]->clipWindow(stripeFrameFormat, window, stripePixelDataLength);
+   profileScan = true;
+   divideIntoStripes(window);
+
+   stripeWorkers->run(activeStripes);
+
+   scanResult = DotScanResult();
+   for (int stripe=0; stripe<activeStripes; ++stripe)
+      scanResult.add(profileDetectors[stripe]->getResult());
+}
+
+
+/// <summary>
+/// Locates the dot from the peaks of the profiles of the latest scan.  The
+/// stripes' rows don't overlap, so their row profiles just get copied; their
+/// column profiles have to be added up.
+/// </summary>
+bool FrameAnalyzer::locateDotFromProfiles(float &x, float &y)
+{
+   const ScanWindow &window = profileDetectors[0]->getWindow();
+   int left = window.left;
+   int right = window.right;
+   int top = window.top;
+   int bottom = profileDetectors[activeStripes - 1]->getWindow().bottom;
+
+   std::fill(&columnProfile[left], &columnProfile[left] + (right - left), 0);
+   for (int stripe=0; stripe<activeStripes; ++stripe)
+   {
+      const ProfileDetector &detector = *profileDetectors[stripe];
+      const ScanWindow &stripeWindow = detector.getWindow();
+      const uint32_t *stripeColumns = detector.getColumnProfile();
+      const uint32_t *stripeRows = detector.getRowProfile();
+      for (int i=stripeWindow.left; i<stripeWindow.right; ++i)
+         columnProfile[i] += stripeColumns[i];
+      std::copy(stripeRows + stripeWindow.top, stripeRows + stripeWindow.bottom, &rowProfile[stripeWindow.top]);
+   }
+
+   return ProfileDetector::findPeak(&columnProfile[0], left, right, x) && ProfileDetector::findPeak(&rowProfile[0], top, bottom, y);
+}
+
+
+/// <summary>
+/// Scans one stripe of the current frame; called on the stripe's thread
+/// </summary>
+void FrameAnalyzer::scanStripe(int stripe)
+{
+   if (profileScan)
+      profileDetectors[stripe]->scan(stripeFrameFormat, stripePixelData, stripeWindows[stripe]);
+   else
+      detectors[stripe]->scan(stripeFrameFormat, stripePixelData, stripePixelDataLength, stripeWindows[stripe]);
+}
@@ -0,0 +1,98 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef FRAMEANALYZER_H
+#define FRAMEANALYZER_H
+
+#include <memory>
+#include <vector>
+#include "BlobLabeller.h"
+#include "CoarseScanner.h"
+#include "DotDetector.h"
+#include "ProfileDetector.h"
+#include "StripeWorkerPool.h"
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// Everything it takes to find the dot in one frame: the detectors, the
+/// threads that run them and all of the scratch space, allocated once up
+/// front.  It has no memory of previous frames; that's FrameHandler's job.
+/// One of these can only work on one frame at a time, so FrameHandler keeps
+/// one per frame it's willing to process concurrently.
+/// </summary>
+class FrameAnalyzer final
+{
+public:
+   FrameAnalyzer(int width, int height, int stripeCount);
+
+   int getStripeCount() const { return stripeWorkers->getStripeCount(); }
+   const DotScanResult &getScanResult() const { return scanResult; }
+   void setLumaCheck(bool check);
+   void setColorTable(const std::shared_ptr<const ColorTable> &table);
+   void setBackground(const uint8_t *plane, int stride);
+
+   void scanFrame(const VideoFrame &frame, ScanWindow window);
+   void scanFramePyramid(const VideoFrame &frame, ScanWindow window, int blockSize);
+   void scanFrameProfiles(const VideoFrame &frame, ScanWindow window);
+   bool locateDot(float &x, float &y);
+   bool locateBlob(BlobPolicy policy, bool haveExpected, float expectedX, float expectedY, float &x, float &y);
+   const BlobLabeller &getBlobLabeller() const { return blobLabeller; }
+
+private:
+   // hits further from the median than this many times the median distance
+   // from it are ignored, unless they're within the minimum distance
+   static constexpr int OutlierDistanceFactor = 3;
+   static constexpr int MinimumOutlierDistance = 2;
+
+   // windows smaller than this aren't worth splitting between threads
+   static constexpr int MinimumStripePixels = 32768;
+
+   // windows smaller than this aren't worth a coarse pass
+   static constexpr int MinimumPyramidPixels = 65536;
+
+private:
+   void divideIntoStripes(const ScanWindow &window);
+   void scanStripe(int stripe);
+   bool isAnyHitListFull() const;
+   bool locateDotFromProfiles(float &x, float &y);
+
+private:
+   int width;
+   int height;
+
+   // each stripe gets its own detectors, and therefore its own results
+   std::vector<std::unique_ptr<DotDetector>> detectors;
+   std::vector<std::unique_ptr<ProfileDetector>> profileDetectors;
+   std::unique_ptr<StripeWorkerPool> stripeWorkers;
+   CoarseScanner coarseScanner;
+   std::vector<ScanWindow> stripeWindows;
+   FrameFormat stripeFrameFormat;
+   const uint8_t *stripePixelData = nullptr;
+   int stripePixelDataLength = 0;
+   int activeStripes = 1;
+   bool profileScan = false;
+   DotScanResult scanResult;
+
+   // the color table our detectors are using, if any; we hold on to it so
+   // that it can't go away in the middle of a scan
+   std::shared_ptr<const ColorTable> colorTable;
+
+   // whether our detectors are checking hits against a background
+   bool haveBackground = false;
+
+   std::vector<uint32_t> columnHistogram;
+   std::vector<uint32_t> rowHistogram;
+   std::vector<int> distanceScratch;
+   BlobLabeller blobLabeller;
+
+   // the stripes' profiles put together
+   std::vector<uint32_t> columnProfile;
+   std::vector<uint32_t> rowProfile;
+};
+
+
+#endif
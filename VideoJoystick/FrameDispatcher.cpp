@@ -0,0 +1,347 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <climits>
+#include <stdexcept>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "FrameDispatcher.h"
+
+
+/// <summary>
+/// Sleeps until someone changes the word from the value we last saw
+/// </summary>
+static void futexWait(std::atomic<uint32_t> &word, uint32_t seen)
+{
+   syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+}
+
+
+/// <summary>
+/// Wakes up to count threads sleeping on the word
+/// </summary>
+static void futexWake(std::atomic<uint32_t> &word, int count)
+{
+   syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+
+/// <summary>
+/// Initializes a new instance of class FrameDispatcher, starting its threads
+/// </summary>
+FrameDispatcher::FrameDispatcher(
+   const Settings &settings,
+   const std::function<void(int slot, uint64_t sequence)> &processFrame,
+   const std::function<void(int slot)> &dropFrame
+   )
+   : settings(settings), processFrame(processFrame), dropFrame(dropFrame)
+{
+   if (this->settings.threadCount < 1)
+      this->settings.threadCount = 1;
+   if (this->settings.queueDepth < 1)
+      this->settings.queueDepth = 1;
+
+   switch (this->settings.policy)
+   {
+   case Policy::Inline:
+      return;
+
+   case Policy::LatestWins:
+      break;
+
+   case Policy::Bounded:
+      {
+         // the ring is a power of two at least as big as the depth we allow
+         uint64_t ringSize = 1;
+         while (ringSize < (uint64_t)this->settings.queueDepth)
+            ringSize <<= 1;
+         ringMask = ringSize - 1;
+         ring.reset(new Cell[ringSize]);
+         for (uint64_t i=0; i<ringSize; ++i)
+            ring[i].sequence = i;
+      }
+      break;
+   }
+
+   for (int i=0; i<this->settings.threadCount; ++i)
+      threads.emplace_back([this](){ processFrames(); });
+}
+
+
+/// <summary>
+/// Releases resources held by the object
+/// </summary>
+FrameDispatcher::~FrameDispatcher()
+{
+   stop();
+}
+
+
+/// <summary>
+/// Returns the name of a policy, as used on the command line
+/// </summary>
+std::string FrameDispatcher::getPolicyName(Policy policy)
+{
+   switch (policy)
+   {
+   case Policy::LatestWins: return "latest";
+   case Policy::Bounded: return "bounded";
+   case Policy::Inline: return "inline";
+   }
+   return std::string();
+}
+
+
+/// <summary>
+/// Posts a frame to be processed; called from the camera's thread, and only
+/// ever from one thread at a time
+/// </summary>
+void FrameDispatcher::post(int slot)
+{
+   if (slot < 0 || (uint64_t)slot >= NoSlot)
+      throw std::logic_error("FrameDispatcher::post: slot out of range");
+
+   // if we're shutting down nobody is going to process it
+   if (terminated)
+   {
+      ++framesDropped;
+      dropFrame(slot);
+      return;
+   }
+
+   switch (settings.policy)
+   {
+   case Policy::Inline:
+      ++framesProcessed;
+      processFrame(slot, inlineSequence++);
+      return;
+
+   case Policy::LatestWins:
+      {
+         // count our frame before a worker can take it, so that the count
+         // can't go negative; the high water mark waits until we know whether
+         // it displaced one, since the mailbox only ever holds the one
+         ++queued;
+
+         // swap our frame in, keeping the count of frames taken; if there was
+         // a frame still waiting it's now stale
+         uint64_t current = mailbox.load();
+         while (!mailbox.compare_exchange_weak(current, packMailbox((uint64_t)slot, current >> 8)))
+            ;
+         int displaced = (int)(current & NoSlot);
+         if (displaced != (int)NoSlot)
+         {
+            --queued;
+            ++framesDropped;
+            dropFrame(displaced);
+         }
+         else
+         {
+            noteMaxQueued(1);
+         }
+      }
+      break;
+
+   case Policy::Bounded:
+      if (!tryEnqueue(slot))
+      {
+         ++framesDropped;
+         dropFrame(slot);
+         return;
+      }
+      break;
+   }
+
+   wakeOne();
+
+   // if stop() ran while we were posting, it may have drained the queue
+   // before we got our frame in, in which case it's up to us
+   if (terminated)
+   {
+      uint64_t sequence;
+      while (tryTake(slot, sequence))
+      {
+         ++framesDropped;
+         dropFrame(slot);
+      }
+   }
+}
+
+
+/// <summary>
+/// Stops the processing threads after they finish what they're working on;
+/// anything still waiting is dropped
+/// </summary>
+void FrameDispatcher::stop()
+{
+   terminated = true;
+   wakeAll();
+
+   for (auto &thread : threads)
+      thread.join();
+   threads.clear();
+
+   if (settings.policy == Policy::Inline)
+      return;
+
+   int slot;
+   uint64_t sequence;
+   while (tryTake(slot, sequence))
+   {
+      ++framesDropped;
+      dropFrame(slot);
+   }
+}
+
+
+/// <summary>
+/// Thread that processes frames
+/// </summary>
+void FrameDispatcher::processFrames()
+{
+   int slot;
+   uint64_t sequence;
+
+   while (!terminated)
+   {
+      if (!tryTake(slot, sequence))
+      {
+         // announce that we're going to sleep, then look once more in case a
+         // frame showed up before the camera's thread could see us
+         uint32_t seen = wakeupCount;
+         ++sleepers;
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         bool taken = tryTake(slot, sequence);
+         if (!taken && !terminated)
+            futexWait(wakeupCount, seen);
+         --sleepers;
+         if (!taken)
+            continue;
+      }
+
+      ++framesProcessed;
+      processFrame(slot, sequence);
+   }
+}
+
+
+/// <summary>
+/// Takes the next waiting frame, if any, and numbers it
+/// </summary>
+bool FrameDispatcher::tryTake(int &slot, uint64_t &sequence)
+{
+   if (settings.policy == Policy::LatestWins)
+   {
+      uint64_t current = mailbox.load();
+      for (;;)
+      {
+         if ((current & NoSlot) == NoSlot)
+            return false;
+         if (mailbox.compare_exchange_weak(current, packMailbox(NoSlot, (current >> 8) + 1)))
+            break;
+      }
+
+      slot = (int)(current & NoSlot);
+      sequence = current >> 8;
+      noteQueued(-1);
+      return true;
+   }
+
+   // Bounded; the dequeue position counts frames taken, which makes it our
+   // sequence number
+   uint64_t position = dequeuePosition.load(std::memory_order_relaxed);
+   for (;;)
+   {
+      Cell &cell = ring[position & ringMask];
+      uint64_t cellSequence = cell.sequence.load(std::memory_order_acquire);
+      int64_t difference = (int64_t)(cellSequence - (position + 1));
+      if (difference < 0)
+         return false;
+
+      if (difference > 0)
+      {
+         position = dequeuePosition.load(std::memory_order_relaxed);
+      }
+      else if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+      {
+         slot = cell.slot;
+         cell.sequence.store(position + ringMask + 1, std::memory_order_release);
+         sequence = position;
+         noteQueued(-1);
+         return true;
+      }
+   }
+}
+
+
+/// <summary>
+/// Adds a frame to the Bounded ring, unless it already holds as many as we
+/// allow; only the camera's thread calls this
+/// </summary>
+bool FrameDispatcher::tryEnqueue(int slot)
+{
+   if (queued >= settings.queueDepth)
+      return false;
+
+   Cell &cell = ring[enqueuePosition & ringMask];
+   if (cell.sequence.load(std::memory_order_acquire) != enqueuePosition)
+      return false;
+
+   // count it before a worker can take it, so that the count can't go
+   // negative
+   noteQueued(1);
+   cell.slot = slot;
+   cell.sequence.store(enqueuePosition + 1, std::memory_order_release);
+   ++enqueuePosition;
+   return true;
+}
+
+
+/// <summary>
+/// Keeps track of the queue depth and its high water mark; frames are
+/// counted in before they're published and out once they're taken
+/// </summary>
+void FrameDispatcher::noteQueued(int delta)
+{
+   noteMaxQueued(queued += delta);
+}
+
+
+/// <summary>
+/// Raises the high water mark to the given depth if it's below it
+/// </summary>
+void FrameDispatcher::noteMaxQueued(int depth)
+{
+   int max = maxQueued;
+   while (depth > max && !maxQueued.compare_exchange_weak(max, depth))
+      ;
+}
+
+
+/// <summary>
+/// Wakes a processing thread, but only bothers the kernel if one is asleep
+/// </summary>
+void FrameDispatcher::wakeOne()
+{
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (sleepers > 0)
+   {
+      ++wakeupCount;
+      futexWake(wakeupCount, 1);
+   }
+}
+
+
+/// <summary>
+/// Wakes all the processing threads
+/// </summary>
+void FrameDispatcher::wakeAll()
+{
+   ++wakeupCount;
+   futexWake(wakeupCount, INT_MAX);
+}
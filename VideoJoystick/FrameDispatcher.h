@@ -0,0 +1,127 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef FRAMEDISPATCHER_H
+#define FRAMEDISPATCHER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/// <summary>
+/// Hands frames from the camera's thread to one or more processing threads,
+/// so that the camera never waits on us.  Frames are identified by their
+/// frame grabber's slot number, and numbered in the order the processing
+/// threads take them so that with more than one thread the results can be put
+/// back in order.
+///
+/// The handoff never takes a lock; idle processing threads sleep on a futex
+/// that the camera's thread only pokes if someone is actually asleep.
+/// </summary>
+class FrameDispatcher final
+{
+public:
+   /// <summary>
+   /// What to do with frames when the processing threads are busy.
+   ///   LatestWins: only the newest frame waits; a newer one displaces it
+   ///   Bounded: up to queueDepth frames wait, in order; beyond that new
+   ///      frames are dropped
+   ///   Inline: no threads, frames are processed on the camera's thread
+   /// </summary>
+   enum class Policy {
+      LatestWins,
+      Bounded,
+      Inline
+   };
+
+   struct Settings {
+      Policy policy = Policy::LatestWins;
+      int threadCount = 1;
+      int queueDepth = 1;
+   };
+
+public:
+   FrameDispatcher(
+      const Settings &settings,
+      const std::function<void(int slot, uint64_t sequence)> &processFrame,
+      const std::function<void(int slot)> &dropFrame
+      );
+   ~FrameDispatcher();
+
+   void post(int slot);
+   void stop();
+
+   Policy getPolicy() const { return settings.policy; }
+   static std::string getPolicyName(Policy policy);
+
+   // frames passed to processFrame, and frames passed to dropFrame because
+   // we weren't keeping up
+   uint64_t getFramesProcessed() const { return framesProcessed; }
+   uint64_t getFramesDropped() const { return framesDropped; }
+
+   // frames waiting for a processing thread, now and at most
+   int getQueueDepth() const { return queued; }
+   int getMaxQueueDepth() const { return maxQueued; }
+   void resetMaxQueueDepth() { maxQueued = (int)queued; }
+
+private:
+   // LatestWins keeps the waiting slot and the count of frames taken so far
+   // in one word, so that taking a frame and numbering it is one operation
+   static constexpr uint64_t NoSlot = 0xFF;
+   static uint64_t packMailbox(uint64_t slot, uint64_t taken) { return (taken << 8) | slot; }
+
+   // a cell of the Bounded ring; its sequence says whether it's waiting to be
+   // written or read on which lap of the ring
+   struct Cell {
+      std::atomic<uint64_t> sequence;
+      int slot;
+   };
+
+private:
+   void processFrames();
+   bool tryTake(int &slot, uint64_t &sequence);
+   bool tryEnqueue(int slot);
+   void noteQueued(int delta);
+   void noteMaxQueued(int depth);
+   void wakeOne();
+   void wakeAll();
+
+private:
+   Settings settings;
+   std::function<void(int, uint64_t)> processFrame;
+   std::function<void(int)> dropFrame;
+   std::vector<std::thread> threads;
+   std::atomic<bool> terminated { false };
+
+   // LatestWins
+   std::atomic<uint64_t> mailbox { packMailbox(NoSlot, 0) };
+
+   // Bounded; one producer, any number of consumers
+   std::unique_ptr<Cell[]> ring;
+   uint64_t ringMask = 0;
+   uint64_t enqueuePosition = 0;
+   std::atomic<uint64_t> dequeuePosition { 0 };
+
+   // Inline
+   uint64_t inlineSequence = 0;
+
+   // wakeups
+   std::atomic<uint32_t> wakeupCount { 0 };
+   std::atomic<int> sleepers { 0 };
+
+   std::atomic<int> queued { 0 };
+   std::atomic<int> maxQueued { 0 };
+   std::atomic<uint64_t> framesProcessed { 0 };
+   std::atomic<uint64_t> framesDropped { 0 };
+};
+
+
+#endif
@@ -2,8 +2,10 @@
 #ifndef FRAMEGRABBER_H
 #define FRAMEGRABBER_H
 
+#include <stdint.h>
 #include <functional>
 #include <memory>
+#include <string>
 #include "VideoFrame.h"
 
 /// <summary>
@@ -17,6 +19,29 @@ public:
 
 	virtual void SetupFrameCallback(const std::function<void(const std::shared_ptr<VideoFrame> &)> &callback) {}
 	virtual void startCapturing() {}
+
+	// grabbers that replay something from a file run out; cameras don't
+	virtual bool isFinished() const { return false; }
+
+	// frames passed to the callback, and frames we had to discard because
+	// the callback wasn't keeping up
+	virtual uint64_t getFramesProcessed() const { return 0; }
+	virtual uint64_t getFramesDropped() const { return 0; }
+
+	// for grabbers that lend out their own buffers: frames that consumers are
+	// holding right now, the most they've held at once, and how many times
+	// they've held all of them, leaving the camera with nowhere to capture to
+	virtual int getFramesHeld() const { return 0; }
+	virtual int getMaxFramesHeld() const { return 0; }
+	virtual uint64_t getTimesPoolExhausted() const { return 0; }
+
+	// for grabbers that hand frames off to processing threads: how they queue
+	// them, and how many are waiting now and have been at most; frames they
+	// displace or turn away count as dropped
+	virtual std::string getQueuePolicy() const { return std::string(); }
+	virtual int getQueueDepth() const { return 0; }
+	virtual int getMaxQueueDepth() const { return 0; }
+	virtual void resetMaxQueueDepth() {}
 };
 
 
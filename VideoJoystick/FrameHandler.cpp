@@ -6,117 +6,386 @@
  */
 
 #include <algorithm>
+#include <cmath>
+#include <thread>
+#include "AllocationCounter.h"
 #include "FrameHandler.h"
+#include "Statistics.h"
 
 
 /// <summary>
-/// Initializes a new instance of class FrameHandler
+/// Initializes a new instance of class FrameHandler.  A pipeline depth greater
+/// than one allows that many frames to be processed concurrently on different
+/// threads, in which case frames must carry sequence numbers so that we can
+/// deliver results in order.  By default we split each frame into as many
+/// stripes as we have cores to spare.
 /// </summary>
-FrameHandler::FrameHandler()
+FrameHandler::FrameHandler(int stripeCount, int pipelineDepth)
 {
+   if (pipelineDepth < 1)
+      pipelineDepth = 1;
+   if (stripeCount <= 0)
+      stripeCount = std::max(1, (int)std::thread::hardware_concurrency() / pipelineDepth);
+
+   for (int i=0; i<pipelineDepth; ++i)
+      analyzers.emplace_back(new FrameAnalyzer(MaxFrameWidth, MaxFrameHeight, stripeCount));
+   analyzerBusy.reset(new std::atomic<bool>[pipelineDepth]);
+   for (int i=0; i<pipelineDepth; ++i)
+      analyzerBusy[i] = false;
+
+   defaultColorTable = ColorTable::createDefault();
+   backgroundModel.reset(new BackgroundModel(MaxFrameWidth, MaxFrameHeight));
 }
 
 
 /// <summary>
-/// Processes the frame, locates the dot, calls the callback
+/// Processes the frame, locates the dot, calls the callback.  This can be
+/// called from as many threads at once as our pipeline depth.
 /// </summary>
 void FrameHandler::HandleFrame(const std::shared_ptr<VideoFrame> &frame)
 {
    auto start = std::chrono::steady_clock::now();
+   uint64_t allocationsAtStart = AllocationCounter::getThreadAllocations();
+   latency.record(LatencyStage::Completion, *frame, frame->getCompletionTimestamp());
+   latency.record(LatencyStage::Handoff, *frame, frame->getHandoffTimestamp());
 
-	// skip the first several frames until the camera warms up
-	++framesReceived;
-	if (framesReceived < 100)
-		return;
-
-   int saturatedCount = 0;
-
-   std::vector<int> xValues;
-   std::vector<int> yValues;
-
-   // To process the entire 640x480 image takes about 100ms; this is
-   // a prime number that limits the number of pixels we actually sample.
-   // Choosing a prime number is close enough to a random sampling.  A value
-   // of 307 drops processing time down to about 0.4ms, not counting the
-   // callback.
-   constexpr int scaledown = 307;
-
-	// get the red intensity of each pixel... I want to know which pixels are red,
-	// and don't have blue or green, so I just report the difference between red and
-	// the larger of blue or green
-	const uint8_t *p = frame->getPixelData();
-	auto pixelDataLength = frame->getPixelDataLength();
-	int i = 0;
-	for (int n=0; n<10000; ++n)
-	{
-      // our current camera setup returns 24-bit BGR
-		uint8_t b = p[i];
-		uint8_t g = p[i+1];
-      uint8_t r = p[i+2];
-		if (r == 255)
-         ++saturatedCount;
-		if (g == 255)
-         ++saturatedCount;
-		if (b == 255)
-         ++saturatedCount;
-
-      // really simple... we are looking for red pixels; anything where
-      // r > b + g is a really quality criterion
-      if (r > b + g)
+	// skip the first several frames until the camera warms up; they still
+	// have to take their turn below so that the sequence doesn't stall
+	bool warmingUp = framesReceived++ < warmupFrames;
+
+   // classify every pixel in our search window and locate the dot
+   FrameAnalyzer *analyzer = nullptr;
+   bool found = false;
+   float x = 0, y = 0;
+   if (!warmingUp)
+   {
+      analyzer = acquireAnalyzer();
+      analyzer->setLumaCheck(lumaCheck);
+      analyzer->setColorTable(std::atomic_load(&colorTable));
+
+      // the background can't be updated while we're scanning against it
+      std::shared_lock<std::shared_mutex> backgroundLock(backgroundMutex, std::defer_lock);
+      if (useBackgroundModel)
       {
-         int x = (i/3)%640;
-         int y = (i/3)/640;
-         xValues.push_back(x);
-         yValues.push_back(y);
+         backgroundLock.lock();
+         analyzer->setBackground(backgroundModel->getPlane(), backgroundModel->getStride());
       }
+      else
+         analyzer->setBackground(nullptr, 0);
 
-      i += 3*scaledown;
-      if (i >= pixelDataLength)
-         i -= pixelDataLength;
-	}
+      switch (searchMode)
+      {
+      case SearchMode::Pyramid:
+         analyzer->scanFramePyramid(*frame, getSearchWindow(), pyramidBlockSize);
+         break;
+      case SearchMode::Profile:
+         analyzer->scanFrameProfiles(*frame, getSearchWindow());
+         break;
+      default:
+         analyzer->scanFrame(*frame, getSearchWindow());
+         break;
+      }
+      found = locateDot(*analyzer, x, y);
+      latency.record(LatencyStage::Detection, *frame);
+   }
 
-	// just to reduce our worries about wild data points we use the
-	// median as our result
-	if (xValues.size() > 0)
-	{
-      std::sort(xValues.begin(), xValues.end());
-      std::sort(yValues.begin(), yValues.end());
-      this->currentX = xValues[xValues.size() / 2];
-      this->currentY = yValues[yValues.size() / 2];
-      if (frameCallback)
-         frameCallback(this->currentX, this->currentY);
-	}
+   // wait for our turn to deliver results; if we're pipelining that means
+   // waiting for all earlier frames, but not forever in case one of them got
+   // lost along the way
+   std::unique_lock<std::mutex> deliveryLock(deliveryMutex);
+   bool late = false;
+   if (analyzers.size() > 1)
+   {
+      uint64_t sequence = frame->getSequence();
+      deliveryCondition.wait_for(deliveryLock, DeliveryTimeout, [&]() { return sequence <= nextSequenceToDeliver; });
+      late = sequence < nextSequenceToDeliver;
+      if (late)
+      {
+         ++framesDeliveredLate;
+         Statistics::getInstance()->increment(Statistic::FramesLate);
+      }
+      else
+         nextSequenceToDeliver = sequence + 1;
+   }
 
-	// note the saturation rate
-	this->saturationPercent = 100.0 * saturatedCount / frame->getPixelDataLength() / 3;
+   // count the frames that fell through the cracks between this one and the
+   // last, whether the camera, the frame grabber or the pipeline lost them
+   if (!late)
+   {
+      uint64_t cameraSequence = frame->getCameraSequence();
+      if (haveCameraSequence && cameraSequence > lastCameraSequence + 1)
+      {
+         framesMissed += cameraSequence - lastCameraSequence - 1;
+         Statistics::getInstance()->increment(Statistic::FramesMissed, cameraSequence - lastCameraSequence - 1);
+      }
+      haveCameraSequence = true;
+      lastCameraSequence = cameraSequence;
+   }
+
+   // report the dot unless a later frame already did
+   if (analyzer != nullptr && !late)
+   {
+      Statistics::getInstance()->increment(found ? Statistic::DotFound : Statistic::DotNotFound);
+      updateTracking(found, x, y);
+      if (found && frameCallback)
+      {
+         frameCallback(x, y, *frame);
+
+         // how long it took from exposure to having the result out the door
+         uint64_t timestamp = frame->getTimestamp();
+         if (timestamp != 0)
+            outputLatency = std::chrono::microseconds((int64_t)(VideoFrame::getCurrentTimestamp() - timestamp) / 1000);
+      }
 
-	// process any requests for frames from TCP clients
+      // note the saturation rate, as a percentage of all the samples in the frame
+      const DotScanResult &scanResult = analyzer->getScanResult();
+      if (scanResult.samplesScanned > 0)
+         this->saturationPercent = 100.0 * scanResult.saturatedCount / scanResult.samplesScanned;
+
+      if (useBackgroundModel)
+         updateBackground(*frame);
+   }
+
+	// process any requests for frames from TCP clients; they get their own
+	// reference to the frame, and format it on their own time
 	{
 		std::lock_guard<std::mutex> lock(frameRequestMutex);
 		while (!frameRequestQueue.empty())
 		{
-			frameRequestQueue.front().set_value(frame->toString());
+			frameRequestQueue.front().set_value(frame);
 			frameRequestQueue.pop_front();
 		}
 	}
 
 	auto elapsed = std::chrono::steady_clock::now() - start;
 	frameProcessTime = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+
+	// note how many times we hit the heap; that should be zero
+	uint32_t allocations = (uint32_t)(AllocationCounter::getThreadAllocations() - allocationsAtStart);
+	frameAllocations = allocations;
+	if (allocations > maxFrameAllocations)
+		maxFrameAllocations = allocations;
+
+   // let the next frame go
+   deliveryLock.unlock();
+   deliveryCondition.notify_all();
+   if (analyzer != nullptr)
+      releaseAnalyzer(analyzer);
+}
+
+
+/// <summary>
+/// Grabs an analyzer that isn't in use; there's always one available unless
+/// someone is calling us from more threads than our pipeline depth, in which
+/// case they have to wait
+/// </summary>
+FrameAnalyzer *FrameHandler::acquireAnalyzer()
+{
+   for (;;)
+   {
+      for (size_t i=0; i<analyzers.size(); ++i)
+      {
+         bool expected = false;
+         if (analyzerBusy[i].compare_exchange_strong(expected, true, std::memory_order_acquire))
+            return analyzers[i].get();
+      }
+      std::this_thread::yield();
+   }
+}
+
+
+/// <summary>
+/// Returns an analyzer acquired from acquireAnalyzer
+/// </summary>
+void FrameHandler::releaseAnalyzer(FrameAnalyzer *analyzer)
+{
+   for (size_t i=0; i<analyzers.size(); ++i)
+      if (analyzers[i].get() == analyzer)
+         analyzerBusy[i].store(false, std::memory_order_release);
+}
+
+
+/// <summary>
+/// Returns the part of the frame that we should search for the dot; the whole
+/// frame if we don't know where it is, else a window around where we expect
+/// it to be
+/// </summary>
+ScanWindow FrameHandler::getSearchWindow()
+{
+   int size = windowSize;
+   float expectedX, expectedY;
+   if (size <= 0 || !getExpectedPosition(expectedX, expectedY))
+      return ScanWindow(0, 0, MaxFrameWidth, MaxFrameHeight);
+
+   int x = (int)std::lround(expectedX);
+   int y = (int)std::lround(expectedY);
+   return ScanWindow(x - size/2, y - size/2, x + size - size/2, y + size - size/2);
+}
+
+
+/// <summary>
+/// Gets where we expect the dot to be in the next frame, assuming it keeps
+/// moving the way it was moving; returns false if we aren't tracking it
+/// </summary>
+bool FrameHandler::getExpectedPosition(float &x, float &y)
+{
+   std::lock_guard<std::mutex> lock(trackingMutex);
+
+   if (trackingMode != TrackingMode::Tracking)
+      return false;
+   x = currentX + velocityX;
+   y = currentY + velocityY;
+   return true;
+}
+
+
+/// <summary>
+/// Locates the dot from the analyzer's latest scan by our dot selection
+/// </summary>
+bool FrameHandler::locateDot(FrameAnalyzer &analyzer, float &x, float &y)
+{
+   BlobPolicy policy;
+   switch (dotSelection)
+   {
+   case DotSelection::LargestBlob:
+      policy = BlobPolicy::Largest;
+      break;
+   case DotSelection::ClosestBlob:
+      policy = BlobPolicy::Closest;
+      break;
+   case DotSelection::BrightestBlob:
+      policy = BlobPolicy::Brightest;
+      break;
+   default:
+      return analyzer.locateDot(x, y);
+   }
+
+   float expectedX = 0, expectedY = 0;
+   bool haveExpected = getExpectedPosition(expectedX, expectedY);
+   return analyzer.locateBlob(policy, haveExpected, expectedX, expectedY, x, y);
+}
+
+
+/// <summary>
+/// Updates our tracking state with the results of the latest frame
+/// </summary>
+void FrameHandler::updateTracking(bool found, float x, float y)
+{
+   std::lock_guard<std::mutex> lock(trackingMutex);
+
+   if (found)
+   {
+      // we only have a velocity if we were already tracking
+      if (trackingMode == TrackingMode::Tracking && framesWithoutHits == 0)
+      {
+         velocityX = x - currentX;
+         velocityY = y - currentY;
+      }
+      else
+      {
+         velocityX = 0;
+         velocityY = 0;
+      }
+
+      currentX = x;
+      currentY = y;
+      framesWithoutHits = 0;
+      trackingMode = TrackingMode::Tracking;
+   }
+   else
+   {
+      // if we lose it for long enough go back to searching the whole frame
+      if (trackingMode == TrackingMode::Tracking && ++framesWithoutHits >= lossTimeout)
+      {
+         framesWithoutHits = 0;
+         velocityX = 0;
+         velocityY = 0;
+         trackingMode = TrackingMode::Acquiring;
+      }
+   }
+}
+
+
+/// <summary>
+/// Refreshes the next band of the background model from the frame
+/// </summary>
+void FrameHandler::updateBackground(const VideoFrame &frame)
+{
+   std::shared_ptr<const ColorTable> table = std::atomic_load(&colorTable);
+   std::unique_lock<std::shared_mutex> lock(backgroundMutex);
+   backgroundModel->update(frame, lumaCheck, table.get());
+}
+
+
+/// <summary>
+/// Turns the background model on or off; turning it on starts from nothing
+/// </summary>
+void FrameHandler::setBackgroundModel(bool enabled)
+{
+   std::unique_lock<std::shared_mutex> lock(backgroundMutex);
+   if (enabled && !useBackgroundModel)
+      backgroundModel->reset();
+   useBackgroundModel = enabled;
+}
+
+
+/// <summary>
+/// Trains a color table on the next frame, from the pixels within the given
+/// radius of where we're tracking the dot and those well outside it, and
+/// switches to it; see ColorTableTrainer.  Returns an error message, or an
+/// empty string if all went well.
+/// </summary>
+std::string FrameHandler::trainColorTable(float dotRadius)
+{
+   if (dotRadius < 1)
+      return "Invalid dot radius";
+
+   // wait for a frame the same way GetImageAsString does
+   std::promise<std::shared_ptr<VideoFrame>> frameRequest;
+   std::future<std::shared_ptr<VideoFrame>> future = frameRequest.get_future();
+   {
+      std::lock_guard<std::mutex> lock(frameRequestMutex);
+      frameRequestQueue.push_back(std::move(frameRequest));
+   }
+   std::shared_ptr<VideoFrame> frame = future.get();
+   if (!ColorTableTrainer::isFormatSupported(frame->getFormat().pixelFormat))
+      return "Color tables need packed RGB frames";
+
+   // frames are handed over after we've tracked them, so where we think the
+   // dot is now is where it was in that frame
+   float x, y;
+   {
+      std::lock_guard<std::mutex> lock(trackingMutex);
+      if (trackingMode != TrackingMode::Tracking || framesWithoutHits > 0)
+         return "No dot to train on";
+      x = currentX;
+      y = currentY;
+   }
+
+   ColorTableTrainer trainer;
+   trainer.addFrame(*frame, x, y, dotRadius);
+   std::shared_ptr<const ColorTable> table = trainer.build();
+   if (!table || table->getDotEntries() == 0)
+      return "No colors found that are the dot's";
+
+   setColorTable(table);
+   return std::string();
 }
 
 
 /// <summary>
 /// Returns an image as a string, so that we can report it over out TCP socket.
 /// This makes a request to whatever thread the camera runs on and waits on the
-/// request.
+/// request.  The frame stays ours until we're done with it, even though the
+/// camera has moved on.
 /// </summary>
 std::string FrameHandler::GetImageAsString(void)
 {
 	// create the request
-	std::promise<std::string> frameRequest;
+	std::promise<std::shared_ptr<VideoFrame>> frameRequest;
 
 	// get the associated future that will return the result
-	std::future<std::string> future = frameRequest.get_future();
+	std::future<std::shared_ptr<VideoFrame>> future = frameRequest.get_future();
 
 	// pop it in the queue
 	{
@@ -125,7 +394,7 @@ std::string FrameHandler::GetImageAsString(void)
 	}
 
 	// wait and return the result
-	return future.get();
+	return future.get()->toString();
 }
 
 
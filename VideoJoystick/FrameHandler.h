@@ -9,10 +9,18 @@
 #define FRAMEHANDLER_H_
 
 #include <stdio.h>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <future>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include "BackgroundModel.h"
+#include "ColorTable.h"
+#include "FrameAnalyzer.h"
+#include "LatencyHistogram.h"
 #include "VideoFrame.h"
 
 /// <summary>
@@ -21,28 +29,191 @@
 class FrameHandler
 {
 public:
-	FrameHandler();
+   /// <summary>
+   /// Acquiring means we're looking for the dot in the whole frame; Tracking
+   /// means we have it and are only looking in a window around where we
+   /// expect it to be
+   /// </summary>
+   enum class TrackingMode {
+      Acquiring,
+      Tracking
+   };
+
+   /// <summary>
+   /// Dense scans every pixel of the search window; Pyramid finds candidate
+   /// regions from a downsample of the window first and scans only those at
+   /// full resolution, which is worth it when we're searching the whole frame;
+   /// Profile scans every pixel but locates the dot from row and column
+   /// redness profiles rather than a list of hits, so it takes the same time
+   /// however much red there is
+   /// </summary>
+   enum class SearchMode {
+      Dense,
+      Pyramid,
+      Profile
+   };
+
+   /// <summary>
+   /// Median locates the dot from all of the hits, by way of their median,
+   /// which lands somewhere between two red things if there are two; the
+   /// others group the hits into blobs and take the largest, the one closest
+   /// to where we expect the dot to be, or the one with the highest mean
+   /// redness
+   /// </summary>
+   enum class DotSelection {
+      Median,
+      LargestBlob,
+      ClosestBlob,
+      BrightestBlob
+   };
+
+public:
+	FrameHandler(int stripeCount = 0, int pipelineDepth = 1);
 	void HandleFrame(const std::shared_ptr<VideoFrame> &frame);
 	std::string GetImageAsString();
    double getSaturiationPercent() const { return saturationPercent; }
 
-   int getX() const { return currentX; }
-   int getY() const { return currentY; }
+   int getStripeCount() const { return analyzers[0]->getStripeCount(); }
+   int getPipelineDepth() const { return (int)analyzers.size(); }
+   uint64_t getFramesDeliveredLate() const { return framesDeliveredLate; }
+   uint64_t getFramesMissed() const { return framesMissed; }
+   float getX() const { return currentX; }
+   float getY() const { return currentY; }
    std::chrono::microseconds getFrameProcessTime() const { return frameProcessTime; }
+   std::chrono::microseconds getOutputLatency() const { return outputLatency; }
+
+   // how long after exposure frames reach each stage of the pipeline; we
+   // record the stages up to detection, and the frame callback is welcome to
+   // record the rest
+   PipelineLatency &getLatency() { return latency; }
+
+   uint32_t getFrameAllocations() const { return frameAllocations; }
+   uint32_t getMaxFrameAllocations() const { return maxFrameAllocations; }
+   void resetMaxFrameAllocations() { maxFrameAllocations = 0; }
+
+   TrackingMode getTrackingMode() const { return trackingMode; }
+   int getWindowSize() const { return windowSize; }
+   void setWindowSize(int size) { windowSize = size; }
+   int getLossTimeout() const { return lossTimeout; }
+   void setLossTimeout(int frames) { lossTimeout = frames; }
 
-   void setFrameNotify(const std::function<void(int,int)> _frameCallback) { frameCallback = _frameCallback; }
+   // how many frames to ignore at the start while the camera settles down;
+   // frames that didn't come from a camera don't need it
+   int getWarmupFrames() const { return warmupFrames; }
+   void setWarmupFrames(int frames) { warmupFrames = frames; }
+
+   SearchMode getSearchMode() const { return searchMode; }
+   void setSearchMode(SearchMode mode) { searchMode = mode; }
+   int getPyramidBlockSize() const { return pyramidBlockSize; }
+   void setPyramidBlockSize(int size) { pyramidBlockSize = (size >= 8) ? 8 : 4; }
+
+   DotSelection getDotSelection() const { return dotSelection; }
+   void setDotSelection(DotSelection selection) { dotSelection = selection; }
+
+   bool getLumaCheck() const { return lumaCheck; }
+   void setLumaCheck(bool check) { lumaCheck = check; }
+
+   // the table that packed RGB pixels are classified by, or null for the
+   // vectorized r > g + b; it can be swapped at any time, and frames already
+   // being scanned finish with the one they started with
+   std::shared_ptr<const ColorTable> getColorTable() const { return std::atomic_load(&colorTable); }
+   void setColorTable(const std::shared_ptr<const ColorTable> &table) { std::atomic_store(&colorTable, table); }
+   const std::shared_ptr<const ColorTable> &getDefaultColorTable() const { return defaultColorTable; }
+   std::string trainColorTable(float dotRadius);
+
+   // whether hits are checked against a model of the things in view that
+   // look like the dot but never move; turning it on starts a new model,
+   // which takes BackgroundModel::UpdateFrames frames to fill in
+   bool getBackgroundModel() const { return useBackgroundModel; }
+   void setBackgroundModel(bool enabled);
+
+   // the callback gets the dot's location and the frame it was found in, so
+   // that it knows which exposure it's acting on
+   void setFrameNotify(const std::function<void(float,float,const VideoFrame &)> _frameCallback) { frameCallback = _frameCallback; }
 
 private:
-	int framesReceived = 0;
+   // the largest frame we're set up for; frames say how big they actually
+   // are, and anything bigger than this just gets cropped
+   static constexpr int MaxFrameWidth = 2048;
+   static constexpr int MaxFrameHeight = 1536;
+
+   // how long we wait for an earlier frame to be delivered before giving
+   // up on it
+   static constexpr std::chrono::milliseconds DeliveryTimeout { 100 };
+
+private:
+   FrameAnalyzer *acquireAnalyzer();
+   void releaseAnalyzer(FrameAnalyzer *analyzer);
+   ScanWindow getSearchWindow();
+   bool getExpectedPosition(float &x, float &y);
+   bool locateDot(FrameAnalyzer &analyzer, float &x, float &y);
+   void updateBackground(const VideoFrame &frame);
+   void updateTracking(bool found, float x, float y);
+
+private:
+	// one analyzer per frame that we can be working on at once, and a flag
+	// for each to say whether it's in use
+	std::vector<std::unique_ptr<FrameAnalyzer>> analyzers;
+	std::unique_ptr<std::atomic<bool>[]> analyzerBusy;
+
+	// when frames are processed concurrently results are delivered in order
+	// of frame sequence number
+	std::mutex deliveryMutex;
+	std::condition_variable deliveryCondition;
+	uint64_t nextSequenceToDeliver = 0;
+	std::atomic<uint64_t> framesDeliveredLate { 0 };
+
+	// frames the camera produced that never made it to us, going by the gaps
+	// in their camera sequence numbers
+	bool haveCameraSequence = false;
+	uint64_t lastCameraSequence = 0;
+	std::atomic<uint64_t> framesMissed { 0 };
+
+	std::atomic<int> framesReceived { 0 };
+	std::atomic<int> warmupFrames { 100 };
 	double saturationPercent = 0;
-	int currentX = 0;
-	int currentY = 0;
+	float currentX = 0;
+	float currentY = 0;
 	std::mutex frameRequestMutex;
-	std::deque<std::promise<std::string>> frameRequestQueue;
+	std::deque<std::promise<std::shared_ptr<VideoFrame>>> frameRequestQueue;
 
 	std::chrono::microseconds frameProcessTime;
+	std::atomic<std::chrono::microseconds> outputLatency { std::chrono::microseconds(0) };
+	PipelineLatency latency;
+	std::atomic<uint32_t> frameAllocations { 0 };
+	std::atomic<uint32_t> maxFrameAllocations { 0 };
+
+   // tracking; a window size of zero means we always search the whole frame
+   std::mutex trackingMutex;
+   std::atomic<TrackingMode> trackingMode { TrackingMode::Acquiring };
+   std::atomic<int> windowSize { 96 };
+   std::atomic<int> lossTimeout { 10 };
+   int framesWithoutHits = 0;
+   float velocityX = 0;
+   float velocityY = 0;
+
+   // how we search the window, and how coarse a pyramid search's first pass
+   // is
+   std::atomic<SearchMode> searchMode { SearchMode::Dense };
+   std::atomic<int> pyramidBlockSize { 8 };
+
+   // how we pick the dot out of the hits
+   std::atomic<DotSelection> dotSelection { DotSelection::Median };
+
+   // whether dot candidates in YUV frames are confirmed against luma
+   std::atomic<bool> lumaCheck { true };
+
+   // the color table in use, which is only ever touched with atomic_load and
+   // atomic_store, and the table of the usual rule, built at startup
+   std::shared_ptr<const ColorTable> colorTable;
+   std::shared_ptr<const ColorTable> defaultColorTable;
+
+   // the background model; scans share it, updates have it to themselves
+   std::atomic<bool> useBackgroundModel { false };
+   std::shared_mutex backgroundMutex;
+   std::unique_ptr<BackgroundModel> backgroundModel;
 
-	std::function<void(int,int)> frameCallback;
+	std::function<void(float,float,const VideoFrame &)> frameCallback;
 };
 
 
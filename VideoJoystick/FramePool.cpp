@@ -0,0 +1,99 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <stdexcept>
+#include "FramePool.h"
+
+
+/// <summary>
+/// Initializes a new instance of class FramePool; the callback gets called
+/// with the slot of each frame as it comes back
+/// </summary>
+FramePool::FramePool(const std::function<void(int)> &onFrameReturned)
+   : onFrameReturned(onFrameReturned)
+{
+}
+
+
+/// <summary>
+/// Destroys the pool; the owner has drained it, so no frames are out
+/// </summary>
+FramePool::~FramePool()
+{
+}
+
+
+/// <summary>
+/// Adds a frame to the pool, returning its slot; this is done at startup, not
+/// while frames are being lent
+/// </summary>
+int FramePool::addFrame(std::unique_ptr<VideoFrame> frame)
+{
+   std::unique_ptr<Slot> slot(new Slot());
+   slot->frame = std::move(frame);
+   slots.push_back(std::move(slot));
+   return (int)slots.size() - 1;
+}
+
+
+/// <summary>
+/// Lends out the frame in the given slot; it comes back when the last copy of
+/// the returned pointer is released
+/// </summary>
+std::shared_ptr<VideoFrame> FramePool::lend(int slot)
+{
+   bool expected = false;
+   if (!slots[slot]->lent.compare_exchange_strong(expected, true))
+      throw std::logic_error("FramePool::lend: frame is already lent");
+
+   int lent = ++framesLent;
+   int max = maxFramesLent;
+   while (lent > max && !maxFramesLent.compare_exchange_weak(max, lent))
+      ;
+   if (lent == (int)slots.size())
+      ++timesExhausted;
+
+   return std::shared_ptr<VideoFrame>(
+      slots[slot]->frame.get(),
+      FrameReturner(),
+      SlotAllocator<VideoFrame>(this, slot)
+      );
+}
+
+
+/// <summary>
+/// Waits for every lent frame to come back, for up to the given time, so
+/// that the owner can tear down what the callback uses; call it once nothing
+/// is lending frames any more.  If they don't all come back the callback is
+/// dropped, so that the stragglers can return without calling into an owner
+/// that's gone, and this returns false; the owner must then leak the pool
+/// rather than destroy it.
+/// </summary>
+bool FramePool::drain(std::chrono::milliseconds timeout)
+{
+   std::unique_lock<std::mutex> lock(returnMutex);
+   if (frameReturned.wait_for(lock, timeout, [this]() { return framesLent == 0; }))
+      return true;
+   onFrameReturned = nullptr;
+   return false;
+}
+
+
+/// <summary>
+/// Called when the last reference to a lent frame has gone away and its
+/// control block is destroyed.  The frame only counts as returned once the
+/// callback is done with it, so that drain doesn't let the owner go while
+/// the callback is still running.
+/// </summary>
+void FramePool::returnFrame(int slot)
+{
+   std::lock_guard<std::mutex> lock(returnMutex);
+   slots[slot]->lent = false;
+   if (onFrameReturned)
+      onFrameReturned(slot);
+   --framesLent;
+   frameReturned.notify_all();
+}
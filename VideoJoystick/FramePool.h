@@ -0,0 +1,129 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// A fixed set of frames, each backed by a buffer that belongs to the frame
+/// grabber.  Lending a frame hands out a shared_ptr to it; when the last copy
+/// of that shared_ptr (or a weak_ptr to it) goes away, on whatever thread
+/// that happens to be, the frame comes back to the pool and the grabber gets
+/// a callback so that it can give the buffer back to the camera.  Until then
+/// nobody overwrites it, so consumers can hang onto frames as long as they
+/// like without copying.
+///
+/// Each slot has room for its shared_ptr's control block, so lending a frame
+/// never touches the heap.
+///
+/// Frames can still be out when the grabber shuts down, say with a TCP client
+/// that's in the middle of sending one, so the grabber has to drain the pool
+/// before it lets go of anything the callback uses.  If they don't all come
+/// back in time the pool gets leaked: its slots hold the control blocks that
+/// the stragglers will release, and the frames they point to.
+/// </summary>
+class FramePool final
+{
+public:
+   // how long drain gives consumers to let go of their frames
+   static constexpr std::chrono::milliseconds DrainTimeout { 2000 };
+
+public:
+   FramePool(const std::function<void(int)> &onFrameReturned);
+   ~FramePool();
+
+   int addFrame(std::unique_ptr<VideoFrame> frame);
+   VideoFrame &getFrame(int slot) { return *slots[slot]->frame; }
+   std::shared_ptr<VideoFrame> lend(int slot);
+   bool drain(std::chrono::milliseconds timeout = DrainTimeout);
+
+   // telemetry; the pool is exhausted when consumers are holding every frame,
+   // which leaves the camera nothing to capture into
+   int getCapacity() const { return (int)slots.size(); }
+   int getFramesLent() const { return framesLent; }
+   int getMaxFramesLent() const { return maxFramesLent; }
+   void resetMaxFramesLent() { maxFramesLent = (int)framesLent; }
+   uint64_t getTimesExhausted() const { return timesExhausted; }
+
+private:
+   // big enough for any standard library's control block for our deleter
+   // and allocator
+   static constexpr size_t ControlBlockSize = 128;
+
+   struct Slot {
+      std::unique_ptr<VideoFrame> frame;
+      std::atomic<bool> lent { false };
+      alignas(std::max_align_t) unsigned char controlBlock[ControlBlockSize];
+   };
+
+   /// <summary>
+   /// Allocator that places a shared_ptr control block in its slot.  The
+   /// control block is deallocated only once it's been destroyed, so that's
+   /// when the frame goes back to the pool; any sooner and the slot could be
+   /// lent again while the old control block is still being torn down.
+   /// </summary>
+   template <typename T>
+   struct SlotAllocator {
+      typedef T value_type;
+
+      FramePool *pool;
+      int slot;
+
+      SlotAllocator(FramePool *_pool, int _slot) : pool(_pool), slot(_slot) {}
+      template <typename U> SlotAllocator(const SlotAllocator<U> &other) : pool(other.pool), slot(other.slot) {}
+
+      T *allocate(size_t n)
+      {
+         static_assert(sizeof(T) <= ControlBlockSize, "FramePool::ControlBlockSize is too small");
+         static_assert(alignof(T) <= alignof(std::max_align_t), "FramePool control block is overaligned");
+         if (n != 1)
+            throw std::bad_alloc();
+         return reinterpret_cast<T *>(pool->slots[slot]->controlBlock);
+      }
+      void deallocate(T *, size_t) { pool->returnFrame(slot); }
+
+      template <typename U> bool operator==(const SlotAllocator<U> &other) const { return pool == other.pool && slot == other.slot; }
+      template <typename U> bool operator!=(const SlotAllocator<U> &other) const { return !(*this == other); }
+   };
+
+   /// <summary>
+   /// The shared_ptr deleter, which doesn't delete anything; the frame comes
+   /// back when its control block is deallocated
+   /// </summary>
+   struct FrameReturner {
+      void operator()(VideoFrame *) const {}
+   };
+
+private:
+   void returnFrame(int slot);
+
+private:
+   std::vector<std::unique_ptr<Slot>> slots;
+   std::function<void(int)> onFrameReturned;
+
+   // serializes returns with drain, which stops the callbacks
+   std::mutex returnMutex;
+   std::condition_variable frameReturned;
+
+   std::atomic<int> framesLent { 0 };
+   std::atomic<int> maxFramesLent { 0 };
+   std::atomic<uint64_t> timesExhausted { 0 };
+};
+
+
+#endif
@@ -0,0 +1,162 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <iostream>
+#include <stdexcept>
+#include "FrameRecorder.h"
+
+
+/// <summary>
+/// Initializes a new instance of class FrameRecorder, creating the file and
+/// starting the thread that writes to it
+/// </summary>
+FrameRecorder::FrameRecorder(const std::filesystem::path &path, int bufferCount)
+{
+   file = fopen(path.c_str(), "wb");
+   if (file == nullptr)
+      throw std::runtime_error("FrameRecorder: can't create " + path.string());
+
+   if (bufferCount < 1)
+      bufferCount = 1;
+   buffers.resize(bufferCount);
+   for (int i=0; i<bufferCount; ++i)
+      freeBuffers.push_back(i);
+
+   writerThread = std::thread([this]() { writeFrames(); });
+}
+
+
+/// <summary>
+/// Releases resources held by the object, after writing whatever frames are
+/// still waiting
+/// </summary>
+FrameRecorder::~FrameRecorder()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      terminated = true;
+   }
+   condition.notify_all();
+   writerThread.join();
+
+   fclose(file);
+}
+
+
+/// <summary>
+/// Queues a copy of the frame to be written; call this from as many threads
+/// as you like
+/// </summary>
+void FrameRecorder::record(const VideoFrame &frame)
+{
+   // claim a buffer, unless they're all waiting on the disk
+   int index;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (terminated || writeFailed || freeBuffers.empty())
+      {
+         ++framesDropped;
+         return;
+      }
+
+      if (!haveFormat)
+      {
+         format = frame.getFormat();
+         haveFormat = true;
+      }
+      else if (frame.getFormat() != format)
+      {
+         ++framesDropped;
+         return;
+      }
+
+      index = freeBuffers.back();
+      freeBuffers.pop_back();
+   }
+
+   // the buffers only ever grow, so once they've seen a frame this doesn't
+   // allocate
+   Buffer &buffer = buffers[index];
+   const uint8_t *pixelData = frame.getPixelData();
+   buffer.header.timestamp = frame.getTimestamp();
+   buffer.header.sequence = frame.getCameraSequence();
+   buffer.header.length = (uint32_t)frame.getPixelDataLength();
+   buffer.header.reserved = 0;
+   buffer.pixelData.assign(pixelData, pixelData + frame.getPixelDataLength());
+
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      buffersToWrite.push_back(index);
+   }
+   condition.notify_one();
+}
+
+
+/// <summary>
+/// Thread that writes frames to the file
+/// </summary>
+void FrameRecorder::writeFrames()
+{
+   static const uint8_t padding[CaptureFileHeader::Alignment] = {};
+   bool headerWritten = false;
+
+   for (;;)
+   {
+      // wait for a frame; when we're told to quit we finish what's queued
+      int index;
+      CaptureFileHeader fileHeader;
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         condition.wait(lock, [this]() { return terminated || !buffersToWrite.empty(); });
+         if (buffersToWrite.empty())
+            break;
+         index = buffersToWrite.front();
+         buffersToWrite.pop_front();
+         if (!headerWritten)
+            fileHeader = CaptureFileHeader::create(format);
+      }
+
+      Buffer &buffer = buffers[index];
+      bool ok = true;
+      if (!headerWritten)
+      {
+         ok = write(&fileHeader, sizeof(fileHeader));
+         headerWritten = true;
+      }
+      size_t length = buffer.header.length;
+      ok = ok && write(&buffer.header, sizeof(buffer.header));
+      ok = ok && write(buffer.pixelData.data(), length);
+      ok = ok && write(padding, CaptureFileHeader::getPaddedLength(length) - length);
+      if (ok)
+         ++framesRecorded;
+      else
+         ++framesDropped;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      freeBuffers.push_back(index);
+   }
+
+   fflush(file);
+}
+
+
+/// <summary>
+/// Writes to the file; once a write fails we give up on the whole thing,
+/// since the file is no good after that anyway
+/// </summary>
+bool FrameRecorder::write(const void *data, size_t length)
+{
+   if (length == 0)
+      return true;
+   if (fwrite(data, 1, length, file) == length)
+      return true;
+
+   std::lock_guard<std::mutex> lock(mutex);
+   if (!writeFailed)
+      std::cerr << "FrameRecorder: write failed" << std::endl;
+   writeFailed = true;
+   return false;
+}
@@ -0,0 +1,73 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef FRAMERECORDER_H
+#define FRAMERECORDER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CaptureFile.h"
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// Writes frames to a capture file on a thread of its own.  Recording a
+/// frame copies it into one of a fixed set of buffers, so the camera's
+/// buffer goes back to it right away; if the disk falls so far behind that
+/// all the buffers are waiting to be written, frames are dropped rather than
+/// holding anyone up.  Frames must all be the same format as the first.
+/// </summary>
+class FrameRecorder final
+{
+public:
+   FrameRecorder(const std::filesystem::path &path, int bufferCount = 8);
+   ~FrameRecorder();
+
+   void record(const VideoFrame &frame);
+
+   uint64_t getFramesRecorded() const { return framesRecorded; }
+   uint64_t getFramesDropped() const { return framesDropped; }
+
+private:
+   struct Buffer {
+      CaptureFrameHeader header;
+      std::vector<uint8_t> pixelData;
+   };
+
+private:
+   void writeFrames();
+   bool write(const void *data, size_t length);
+
+private:
+   FILE *file = nullptr;
+
+   // buffers are either free or waiting to be written
+   std::vector<Buffer> buffers;
+   std::mutex mutex;
+   std::condition_variable condition;
+   std::vector<int> freeBuffers;
+   std::deque<int> buffersToWrite;
+   bool terminated = false;
+   bool writeFailed = false;
+   std::thread writerThread;
+
+   // the format is set by the first frame
+   bool haveFormat = false;
+   FrameFormat format;
+
+   std::atomic<uint64_t> framesRecorded { 0 };
+   std::atomic<uint64_t> framesDropped { 0 };
+};
+
+
+#endif
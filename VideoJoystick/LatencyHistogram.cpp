@@ -0,0 +1,169 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <algorithm>
+#include <cmath>
+#include "LatencyHistogram.h"
+
+
+// =====================================================
+//  class LatencyHistogram
+// =====================================================
+
+/// <summary>
+/// Counts a value
+/// </summary>
+void LatencyHistogram::record(uint64_t nanoseconds)
+{
+   if (nanoseconds > MaxValue)
+      nanoseconds = MaxValue;
+
+   buckets[getBucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+   count.fetch_add(1, std::memory_order_relaxed);
+
+   uint64_t currentMax = max.load(std::memory_order_relaxed);
+   while (nanoseconds > currentMax && !max.compare_exchange_weak(currentMax, nanoseconds, std::memory_order_relaxed))
+      ;
+}
+
+
+/// <summary>
+/// Forgets everything; anything recorded while we're at it may or may not
+/// survive
+/// </summary>
+void LatencyHistogram::reset()
+{
+   for (auto &bucket : buckets)
+      bucket.store(0, std::memory_order_relaxed);
+   count.store(0, std::memory_order_relaxed);
+   max.store(0, std::memory_order_relaxed);
+}
+
+
+/// <summary>
+/// Returns the value that the given percentage of values are at or below,
+/// rounded up to the top of its bucket
+/// </summary>
+uint64_t LatencyHistogram::getPercentile(double percent) const
+{
+   uint64_t total = count.load(std::memory_order_relaxed);
+   if (total == 0)
+      return 0;
+
+   uint64_t target = (uint64_t)std::ceil(percent / 100.0 * total);
+   if (target < 1)
+      target = 1;
+
+   uint64_t seen = 0;
+   for (int i=0; i<BucketCount; ++i)
+   {
+      seen += buckets[i].load(std::memory_order_relaxed);
+      if (seen >= target)
+         return std::min(getBucketValue(i), getMax());
+   }
+   return getMax();
+}
+
+
+/// <summary>
+/// Values below SubBuckets get a bucket each; above that each power of two
+/// gets SubBuckets buckets, indexed by the bits just below its top bit
+/// </summary>
+int LatencyHistogram::getBucketIndex(uint64_t value)
+{
+   if (value < SubBuckets)
+      return (int)value;
+
+   int topBit = 63 - __builtin_clzll(value);
+   int shift = topBit - SubBucketBits;
+   return (shift + 1) * SubBuckets + (int)((value >> shift) & (SubBuckets - 1));
+}
+
+
+/// <summary>
+/// Returns the largest value that lands in the given bucket
+/// </summary>
+uint64_t LatencyHistogram::getBucketValue(int index)
+{
+   if (index < SubBuckets)
+      return (uint64_t)index;
+
+   int shift = index / SubBuckets - 1;
+   uint64_t subBucket = (uint64_t)(index % SubBuckets);
+   return ((SubBuckets + subBucket + 1) << shift) - 1;
+}
+
+
+
+// =====================================================
+//  class PipelineLatency
+// =====================================================
+
+/// <summary>
+/// Records how long after its exposure the frame reached the given stage
+/// </summary>
+void PipelineLatency::record(LatencyStage stage, const VideoFrame &frame, uint64_t timestamp)
+{
+   uint64_t exposure = frame.getTimestamp();
+   if (exposure == 0 || timestamp == 0)
+      return;
+
+   // clocks don't run backwards, but a grabber that stamps frames on arrival
+   // can make a stage look earlier than the exposure
+   histograms[(int)stage].record(timestamp > exposure ? timestamp - exposure : 0);
+}
+
+
+/// <summary>
+/// Resets all the histograms
+/// </summary>
+void PipelineLatency::reset()
+{
+   for (auto &histogram : histograms)
+      histogram.reset();
+}
+
+
+/// <summary>
+/// Returns the name of a stage
+/// </summary>
+const char *PipelineLatency::getStageName(LatencyStage stage)
+{
+   switch (stage)
+   {
+   case LatencyStage::Completion: return "completion";
+   case LatencyStage::Handoff: return "handoff";
+   case LatencyStage::Detection: return "detection";
+   case LatencyStage::Transform: return "transform";
+   case LatencyStage::Output: return "output";
+   case LatencyStage::Count: break;
+   }
+   return "";
+}
+
+
+/// <summary>
+/// Formats the histograms for our command line, as
+/// "stage:p50,p90,p99,max" for each stage in microseconds, separated by
+/// semicolons
+/// </summary>
+std::string PipelineLatency::toString() const
+{
+   std::string result;
+   for (int i=0; i<(int)LatencyStage::Count; ++i)
+   {
+      const LatencyHistogram &histogram = histograms[i];
+      if (!result.empty())
+         result += ";";
+      result += getStageName((LatencyStage)i);
+      result += ":";
+      result += std::to_string(histogram.getPercentile(50) / 1000) + ",";
+      result += std::to_string(histogram.getPercentile(90) / 1000) + ",";
+      result += std::to_string(histogram.getPercentile(99) / 1000) + ",";
+      result += std::to_string(histogram.getMax() / 1000);
+   }
+   return result;
+}
@@ -0,0 +1,88 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// Histogram of latencies in nanoseconds, in the style of HdrHistogram: each
+/// power of two is split into SubBuckets linear buckets, so any value is
+/// reported to within about 3% whatever its size, in a fixed amount of
+/// memory.  Recording is a couple of relaxed atomic operations, so any number
+/// of threads can record at once without locking or allocating.
+/// </summary>
+class LatencyHistogram final
+{
+public:
+   LatencyHistogram() { reset(); }
+
+   void record(uint64_t nanoseconds);
+   void reset();
+
+   uint64_t getCount() const { return count; }
+   uint64_t getMax() const { return max; }
+   uint64_t getPercentile(double percent) const;
+
+private:
+   static constexpr int SubBucketBits = 5;
+   static constexpr int SubBuckets = 1 << SubBucketBits;
+
+   // about two minutes; anything longer is lumped in with that
+   static constexpr int MaxValueBits = 37;
+   static constexpr uint64_t MaxValue = ((uint64_t)1 << MaxValueBits) - 1;
+   static constexpr int BucketCount = (MaxValueBits - SubBucketBits + 1) * SubBuckets;
+
+private:
+   static int getBucketIndex(uint64_t value);
+   static uint64_t getBucketValue(int index);
+
+private:
+   std::atomic<uint64_t> buckets[BucketCount];
+   std::atomic<uint64_t> count;
+   std::atomic<uint64_t> max;
+};
+
+
+/// <summary>
+/// Points that a frame passes on its way from the sensor to the DAC
+/// </summary>
+enum class LatencyStage {
+   Completion,    // the camera hands us the buffer
+   Handoff,       // a processing thread picks it up
+   Detection,     // we know where the dot is
+   Transform,     // XYDriver has turned that into a joystick position
+   Output,        // the SPI ioctl to the DAC has returned
+   Count
+};
+
+
+/// <summary>
+/// A histogram for each stage of the pipeline, of how long after the frame's
+/// exposure it got there; frames without a timestamp aren't counted
+/// </summary>
+class PipelineLatency final
+{
+public:
+   void record(LatencyStage stage, const VideoFrame &frame, uint64_t timestamp = VideoFrame::getCurrentTimestamp());
+   void reset();
+
+   const LatencyHistogram &getHistogram(LatencyStage stage) const { return histograms[(int)stage]; }
+   static const char *getStageName(LatencyStage stage);
+
+   std::string toString() const;
+
+private:
+   LatencyHistogram histograms[(int)LatencyStage::Count];
+};
+
+
+#endif
@@ -4,19 +4,32 @@
 // Warantee: none, your own risk
 //
 
+#include <algorithm>
 #include "LibCameraFrameGrabber.h"
+#include "Statistics.h"
 
 
 /// <summary>
 /// Initializes a new instance of class LibCameraFrameGrabber
 /// </summary>
-LibCameraFrameGrabber::LibCameraFrameGrabber()
+LibCameraFrameGrabber::LibCameraFrameGrabber(const FrameDispatcher::Settings &dispatchSettings, PixelFormat pixelFormat)
 {
+   this->pixelFormat = pixelFormat;
+
    // initialize libcamera
    cameraManager = LibCameraManager::Initialize();
 
-   // create our frame processing thread
-   frameProcessingThread = new std::thread([this](){ processFrames(); });
+   // create our frame processing threads; frames that they can't keep up
+   // with go straight back to the camera
+   frameDispatcher.reset(new FrameDispatcher(
+      dispatchSettings,
+      [this](int slot, uint64_t sequence) { processFrame(slot, sequence); },
+      [this](int slot)
+      {
+         Statistics::getInstance()->increment(Statistic::FramesDisplaced);
+         onFrameReturned(slot);
+      }
+      ));
 }
 
 
@@ -25,19 +38,18 @@ LibCameraFrameGrabber::LibCameraFrameGrabber()
 /// </summary>
 LibCameraFrameGrabber::~LibCameraFrameGrabber()
 {
-   // signal the frame processing thread to terminate
+   // shut down our frame processing threads; from here on frames that come
+   // back stay with us
+   terminated = true;
+   if (frameDispatcher)
+      frameDispatcher->stop();
+
+   // wait for whoever's still holding frames to let go; if they don't, the
+   // pool has to outlive us
+   if (!framePool->drain())
    {
-      std::lock_guard<std::mutex> lock(frameToProcessMutex);
-      terminated = true;
-      frameToProcessCondition.notify_all();
-   }
-
-   // shut down our frame processing thread
-   if (frameProcessingThread != nullptr)
-   {
-      frameProcessingThread->join();
-      delete frameProcessingThread;
-      frameProcessingThread = nullptr;
+      std::cerr << "LibCameraFrameGrabber: frames still held at shutdown, leaking them" << std::endl;
+      framePool.release();
    }
 
    // this is the official camera shutdown procedure
@@ -58,11 +70,15 @@ LibCameraFrameGrabber::~LibCameraFrameGrabber()
 
 /// <summary>
 /// Creates an instance assuming that there is exactly one camera device on
-/// the system; fails if there is not a unique camera
+/// the system; fails if there is not a unique camera.  The dispatch settings
+/// say how frames get from libcamera's completion thread to the callback;
+/// with more than one processing thread the callback gets called
+/// concurrently for consecutive frames.  The pixel format is the one we ask
+/// the camera for; frames are tagged with whatever it actually agrees to.
 /// </summary>
-LibCameraFrameGrabber *LibCameraFrameGrabber::createUniqueCamera()
+LibCameraFrameGrabber *LibCameraFrameGrabber::createUniqueCamera(const FrameDispatcher::Settings &dispatchSettings, PixelFormat pixelFormat)
 {
-   std::unique_ptr<LibCameraFrameGrabber> camera(new LibCameraFrameGrabber());
+   std::unique_ptr<LibCameraFrameGrabber> camera(new LibCameraFrameGrabber(dispatchSettings, pixelFormat));
    camera->openUniqueCamera();
    return camera.release();
 }
@@ -107,7 +123,25 @@ void LibCameraFrameGrabber::configureCamera()
    config.size.width = 640;
    config.size.height = 480;
    config.bufferCount = 10;
-   config.pixelFormat = libcamera::formats::RGB888;
+   switch (pixelFormat)
+   {
+   case PixelFormat::RGB24:
+      config.pixelFormat = libcamera::formats::BGR888;
+      break;
+   case PixelFormat::XRGB8888:
+      config.pixelFormat = libcamera::formats::XRGB8888;
+      break;
+   case PixelFormat::YUV420:
+      config.pixelFormat = libcamera::formats::YUV420;
+      break;
+   case PixelFormat::BGR24:
+      config.pixelFormat = libcamera::formats::RGB888;
+      break;
+   default:
+      // raw; we leave the format alone since the Bayer order is up to the
+      // sensor, and take whatever 10-bit layout we get
+      break;
+   }
    std::cout << cameraConfiguration->at(0).pixelFormat.toString() << std::endl;
    cameraConfiguration->validate();
    std::cout << cameraConfiguration->at(0).toString() << std::endl;
@@ -115,7 +149,43 @@ void LibCameraFrameGrabber::configureCamera()
    if (0 != camera->configure(cameraConfiguration.get()))
       throw std::runtime_error("LibCameraFrameGrabber::configureCamera: configure failed");
 
-   std::cout << cameraConfiguration->at(0).pixelFormat.toString() << std::endl;
+   // validation may have given us something other than what we asked for;
+   // libcamera names formats by their little-endian word layout, we name them
+   // by byte order in memory
+   libcamera::PixelFormat negotiated = cameraConfiguration->at(0).pixelFormat;
+   std::cout << negotiated.toString() << std::endl;
+   if (negotiated == libcamera::formats::RGB888)
+      pixelFormat = PixelFormat::BGR24;
+   else if (negotiated == libcamera::formats::BGR888)
+      pixelFormat = PixelFormat::RGB24;
+   else if (negotiated == libcamera::formats::XRGB8888)
+      pixelFormat = PixelFormat::XRGB8888;
+   else if (negotiated == libcamera::formats::YUV420)
+      pixelFormat = PixelFormat::YUV420;
+   else if (negotiated == libcamera::formats::SRGGB10)
+      pixelFormat = PixelFormat::BayerRGGB10;
+   else if (negotiated == libcamera::formats::SGRBG10)
+      pixelFormat = PixelFormat::BayerGRBG10;
+   else if (negotiated == libcamera::formats::SGBRG10)
+      pixelFormat = PixelFormat::BayerGBRG10;
+   else if (negotiated == libcamera::formats::SBGGR10)
+      pixelFormat = PixelFormat::BayerBGGR10;
+   else if (negotiated == libcamera::formats::SRGGB10_CSI2P)
+      pixelFormat = PixelFormat::BayerRGGB10Packed;
+   else if (negotiated == libcamera::formats::SGRBG10_CSI2P)
+      pixelFormat = PixelFormat::BayerGRBG10Packed;
+   else if (negotiated == libcamera::formats::SGBRG10_CSI2P)
+      pixelFormat = PixelFormat::BayerGBRG10Packed;
+   else if (negotiated == libcamera::formats::SBGGR10_CSI2P)
+      pixelFormat = PixelFormat::BayerBGGR10Packed;
+   else
+      throw std::runtime_error("LibCameraFrameGrabber::configureCamera: unsupported pixel format " + negotiated.toString());
+
+   // rows may well be padded, and raw frames are whatever size the sensor
+   // mode is rather than what we asked for
+   const auto &negotiatedConfig = cameraConfiguration->at(0);
+   frameFormat = FrameFormat::create(pixelFormat, negotiatedConfig.size.width, negotiatedConfig.size.height, negotiatedConfig.stride);
+   std::cout << frameFormat.width << "x" << frameFormat.height << ", stride " << frameFormat.planeStride[0] << std::endl;
 }
 
 
@@ -142,27 +212,47 @@ void LibCameraFrameGrabber::startCapturing()
    if (0 != camera->start(&controls))
       throw std::runtime_error("LibCameraFrameGrabber::startCapturing: start failed");
 
+   // requests and frames both get indexed by the buffer's cookie, from the
+   // camera's threads as soon as we queue the first one, so they have to be
+   // in place before we do and never move
+   requests.reserve(buffersAllocated);
    for (int i=0; i<buffersAllocated; ++i)
    {
       // get the frame buffer and set its index for future reference
       auto &frameBuffer = frameBufferAllocator->buffers(stream)[i];
       frameBuffer->setCookie(i);
 
-      // create a VideoFrame to associate with it
-      std::shared_ptr<VideoFrame> frame;
-      frame.reset(new MmapVideoFrame(frameBuffer->planes()[0].fd.get(), frameBuffer->planes()[0].length));
-      frames.push_back(frame);
+      // create a VideoFrame to associate with it; the planes of YUV frames
+      // are all in the same buffer, so we map the lot and note where each
+      // plane starts
+      const auto &planes = frameBuffer->planes();
+      FrameFormat bufferFormat = frameFormat;
+      size_t mappedLength = 0;
+      for (size_t plane=0; plane<planes.size() && plane<FrameFormat::MaxPlanes; ++plane)
+      {
+         if (plane > 0 && planes[plane].fd.get() != planes[0].fd.get())
+            throw std::runtime_error("LibCameraFrameGrabber::startCapturing: planes in separate buffers");
+         bufferFormat.planeOffset[plane] = planes[plane].offset;
+         mappedLength = std::max(mappedLength, (size_t)planes[plane].offset + planes[plane].length);
+      }
+
+      std::unique_ptr<VideoFrame> frame(new MmapVideoFrame(planes[0].fd.get(), mappedLength));
+      frame->setFormat(bufferFormat);
+      framePool->addFrame(std::move(frame));
 
-      // create and enqueue the request
+      // create the request
       std::unique_ptr<libcamera::Request> request = camera->createRequest((uint64_t)this);
       if (!request)
          throw std::runtime_error("LibCameraFrameGrabber::startCapturing: createRequest failed");
       if (0 != request->addBuffer(stream, frameBuffer.get()))
          throw std::runtime_error("LibCameraFrameGrabber::startCapturing: addBuffer failed");
-      if (0 != camera->queueRequest(request.get()))
-         throw std::runtime_error("LibCameraFrameGrabber::startCapturing: queueRequest failed");
       requests.push_back(std::move(request));
    }
+
+   // and let the camera have them
+   for (auto &request : requests)
+      if (0 != camera->queueRequest(request.get()))
+         throw std::runtime_error("LibCameraFrameGrabber::startCapturing: queueRequest failed");
 }
 
 
@@ -174,78 +264,63 @@ void LibCameraFrameGrabber::onRequestCompleted(libcamera::Request *request)
    // if the frame was canceled it almost certainly means that we are shutting
    // down so we should proceed to the nearest exit
    if (request->status() == libcamera::Request::RequestCancelled)
-      return;
-
-   // some reassuring diagnostics for now
-   ++frameCount;
-   auto now = std::chrono::steady_clock::now();
-   if (now - frameCountReference >= std::chrono::milliseconds(1000))
    {
-      libcamera::FrameBuffer *frameBuffer = request->findBuffer(cameraConfiguration->at(0).stream());
-      int planeSize = frameBuffer->planes()[0].length;
-      std::cout << frameCount << "," << framesProcessed << "," << planeSize << std::endl;
-      frameCount = 0;
-      framesProcessed = 0;
-      frameCountReference = now;
+      Statistics::getInstance()->increment(Statistic::FramesCancelled);
+      return;
    }
 
-   // pass it off to the thread that processes requests
-   {
-      // lock
-      std::lock_guard<std::mutex> lock(frameToProcessMutex);
+   Statistics::getInstance()->increment(Statistic::FramesCompleted);
 
-      // if we have a request waiting to be processed we want to requeue it
-      // before we replace it with the new request
-      if (requestToProcess != nullptr && !terminated)
-      {
-         requestToProcess->reuse(libcamera::Request::ReuseBuffers);
-         if (0 != camera->queueRequest(requestToProcess))
-            throw std::runtime_error("LibCameraFrameGrabber::onRequestCompleted: queueRequest failed");
-         requestToProcess = nullptr;
-      }
+   // pass it off to the thread that processes frames; the frame is ours
+   // until then
+   libcamera::FrameBuffer *frameBuffer = request->findBuffer(cameraConfiguration->at(0).stream());
+   int slot = (int)frameBuffer->cookie();
+   framePool->getFrame(slot).setCompletionTimestamp(VideoFrame::getCurrentTimestamp());
+   frameDispatcher->post(slot);
+}
 
-      // post the request to be processed
-      requestToProcess = request;
 
-      // trigger the condition
-      frameToProcessCondition.notify_all();
-   }
+/// <summary>
+/// Processes the frame in the given slot; called on one of the dispatcher's
+/// threads
+/// </summary>
+void LibCameraFrameGrabber::processFrame(int slot, uint64_t sequence)
+{
+   libcamera::Request *request = requests[slot].get();
+   libcamera::FrameBuffer *frameBuffer = request->findBuffer(cameraConfiguration->at(0).stream());
+   VideoFrame &pooledFrame = framePool->getFrame(slot);
+   pooledFrame.setSequence(sequence);
+   pooledFrame.setHandoffTimestamp(VideoFrame::getCurrentTimestamp());
+
+   // the sensor's frame number, and when it started exposing the frame; the
+   // buffer's timestamp is when it finished, which is the best we can do if
+   // the pipeline doesn't report the sensor's
+   pooledFrame.setCameraSequence(frameBuffer->metadata().sequence);
+   auto sensorTimestamp = request->metadata().get(libcamera::controls::SensorTimestamp);
+   pooledFrame.setTimestamp(sensorTimestamp ? (uint64_t)*sensorTimestamp : frameBuffer->metadata().timestamp);
+
+   // lend the frame to the callback; the request goes back to the camera when
+   // the last reference to the frame is released, which is normally right
+   // here, unless someone wants to keep it
+   std::shared_ptr<VideoFrame> frame = framePool->lend(slot);
+   Statistics::getInstance()->increment(Statistic::FramesProcessed);
+   if (videoFrameCallback)
+      videoFrameCallback(frame);
 }
 
 
 /// <summary>
-/// Thread that processes frames
+/// Called when the last reference to a frame we lent out goes away, on
+/// whatever thread released it; gives its request back to the camera
 /// </summary>
-void LibCameraFrameGrabber::processFrames()
+void LibCameraFrameGrabber::onFrameReturned(int slot)
 {
-   while (!terminated)
-   {
-      // wait for a frame to show up
-      libcamera::Request *request = nullptr;
-      {
-         std::unique_lock<std::mutex> lock(frameToProcessMutex);
-         frameToProcessCondition.wait(lock, [this](){ return terminated || requestToProcess != nullptr; });
-         request = requestToProcess;
-         requestToProcess = nullptr;
-      }
+   if (terminated)
+      return;
 
-      // process if we got one
-      if (request != nullptr && !terminated)
-      {
-         ++framesProcessed;
-
-         // dawdle to simulate that we are working really hard
-         if (videoFrameCallback)
-         {
-            libcamera::FrameBuffer *frameBuffer = request->findBuffer(cameraConfiguration->at(0).stream());
-            std::shared_ptr<VideoFrame> frame = frames[frameBuffer->cookie()];
-            videoFrameCallback(frame);
-         }
-
-         // requeue
-         request->reuse(libcamera::Request::ReuseBuffers);
-         if (0 != camera->queueRequest(request))
-            throw std::runtime_error("LibCameraFrameGrabber::processFrames: queueRequest failed");
-      }
-   }
+   // we can't throw from here, since we're likely in a destructor
+   libcamera::Request *request = requests[slot].get();
+   request->reuse(libcamera::Request::ReuseBuffers);
+   if (0 != camera->queueRequest(request))
+      std::cerr << "LibCameraFrameGrabber::onFrameReturned: queueRequest failed" << std::endl;
 }
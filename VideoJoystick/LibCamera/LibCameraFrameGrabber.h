@@ -7,11 +7,10 @@
 #ifndef LIBCAMERA_FRAMEGRABBER_H
 #define LIBCAMERA_FRAMEGRABBER_H
 
-#include <chrono>
-#include <condition_variable>
-#include <mutex>
-#include <thread>
+#include <atomic>
+#include "FrameDispatcher.h"
 #include "FrameGrabber.h"
+#include "FramePool.h"
 #include "LibCameraManager.h"
 #include "VideoFrame.h"
 
@@ -19,41 +18,57 @@ class LibCameraFrameGrabber : public FrameGrabber
 {
 public:
    virtual ~LibCameraFrameGrabber();
-   static LibCameraFrameGrabber *createUniqueCamera();
+   static LibCameraFrameGrabber *createUniqueCamera(const FrameDispatcher::Settings &dispatchSettings = FrameDispatcher::Settings(), PixelFormat pixelFormat = PixelFormat::BGR24);
 
 	void startCapturing() override;
 	void SetupFrameCallback(const std::function<void(const std::shared_ptr<VideoFrame> &)> &callback) override { videoFrameCallback = callback; }
 
+   uint64_t getFramesProcessed() const override { return frameDispatcher->getFramesProcessed(); }
+   uint64_t getFramesDropped() const override { return frameDispatcher->getFramesDropped(); }
+   int getFramesHeld() const override { return framePool->getFramesLent(); }
+   int getMaxFramesHeld() const override { return framePool->getMaxFramesLent(); }
+   uint64_t getTimesPoolExhausted() const override { return framePool->getTimesExhausted(); }
+   std::string getQueuePolicy() const override { return FrameDispatcher::getPolicyName(frameDispatcher->getPolicy()); }
+   int getQueueDepth() const override { return frameDispatcher->getQueueDepth(); }
+   int getMaxQueueDepth() const override { return frameDispatcher->getMaxQueueDepth(); }
+   void resetMaxQueueDepth() override { frameDispatcher->resetMaxQueueDepth(); }
+
 private:
-   LibCameraFrameGrabber();
+   LibCameraFrameGrabber(const FrameDispatcher::Settings &dispatchSettings, PixelFormat pixelFormat);
 
    void configureCamera();
    void onRequestCompleted(libcamera::Request *request);
    void openUniqueCamera();
 
-   void processFrames();
+   void processFrame(int slot, uint64_t sequence);
+   void onFrameReturned(int slot);
 
 private:
    static void requestCompletedCallback(libcamera::Request *request) { ((LibCameraFrameGrabber*)request->cookie())->onRequestCompleted(request); }
 
 private:
-   bool terminated = false;
+   std::atomic<bool> terminated { false };
    std::function<void(const std::shared_ptr<VideoFrame> &)> videoFrameCallback;
 
    std::shared_ptr<libcamera::CameraManager> cameraManager;
    std::shared_ptr<libcamera::Camera> camera;
    std::unique_ptr<libcamera::CameraConfiguration> cameraConfiguration;
+   PixelFormat pixelFormat = PixelFormat::BGR24;
+   FrameFormat frameFormat;
    std::unique_ptr<libcamera::FrameBufferAllocator> frameBufferAllocator;
    std::vector<std::unique_ptr<libcamera::Request>> requests;
-   std::vector<std::shared_ptr<VideoFrame>> frames;
-   std::chrono::steady_clock::time_point frameCountReference;
-   int frameCount = 0;
-   int framesProcessed = 0;
-
-   std::thread *frameProcessingThread = nullptr;
-   libcamera::Request *requestToProcess = nullptr;
-   std::condition_variable frameToProcessCondition;
-   std::mutex frameToProcessMutex;
+
+   // a frame for each of our buffers, lent out to the callback; a buffer
+   // doesn't go back to the camera until everyone is done with its frame, and
+   // the pool gets leaked if someone never is
+   std::unique_ptr<FramePool> framePool { new FramePool([this](int slot) { onFrameReturned(slot); }) };
+
+   // hands completed requests to the processing threads, or processes them
+   // on the spot with the Inline policy; with more than one processing thread
+   // consecutive frames get processed concurrently, and the sequence numbers
+   // the dispatcher gives them let the callback sort out the order of the
+   // results
+   std::unique_ptr<FrameDispatcher> frameDispatcher;
 };
 
 #endif // LIBCAMERA_FRAMEGRABBER_H
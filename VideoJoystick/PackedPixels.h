@@ -0,0 +1,117 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef PACKEDPIXELS_H
+#define PACKEDPIXELS_H
+
+#include <stdint.h>
+#include <type_traits>
+#include "VideoFrame.h"
+
+#if defined(__ARM_NEON)
+   #include <arm_neon.h>
+#elif defined(__SSSE3__)
+   #include <tmmintrin.h>
+#endif
+
+
+// documentation break
+//
+// What the kernels that read packed RGB pixels (DotDetector and
+// CoarseScanner) need to know about them, and how DotDetector pulls their
+// channels apart with SSSE3; NEON builds have vld3q/vld4q for that.
+//
+
+
+/// <summary>
+/// Where each channel lives in a packed pixel
+/// </summary>
+template <PixelFormat Format> struct PackedLayout;
+
+template <> struct PackedLayout<PixelFormat::BGR24> {
+   static constexpr int BytesPerPixel = 3;
+   static constexpr int Red = 2;
+   static constexpr int Green = 1;
+   static constexpr int Blue = 0;
+};
+
+template <> struct PackedLayout<PixelFormat::RGB24> {
+   static constexpr int BytesPerPixel = 3;
+   static constexpr int Red = 0;
+   static constexpr int Green = 1;
+   static constexpr int Blue = 2;
+};
+
+template <> struct PackedLayout<PixelFormat::XRGB8888> {
+   static constexpr int BytesPerPixel = 4;
+   static constexpr int Red = 2;
+   static constexpr int Green = 1;
+   static constexpr int Blue = 0;
+};
+
+
+/// <summary>
+/// Calls the function with the format as a compile time constant, for
+/// picking the instantiation of a kernel that's templated on it, as in
+///   dispatchPackedRGB(format, [&](auto packed) { scan<decltype(packed)::value>(...); });
+/// Returns false without calling it if the format isn't one that isPackedRGB
+/// accepts; the two have to agree.
+/// </summary>
+template <typename Function>
+inline bool dispatchPackedRGB(PixelFormat format, Function &&function)
+{
+   switch (format)
+   {
+   case PixelFormat::BGR24:
+      function(std::integral_constant<PixelFormat, PixelFormat::BGR24>());
+      return true;
+   case PixelFormat::RGB24:
+      function(std::integral_constant<PixelFormat, PixelFormat::RGB24>());
+      return true;
+   case PixelFormat::XRGB8888:
+      function(std::integral_constant<PixelFormat, PixelFormat::XRGB8888>());
+      return true;
+   default:
+      return false;
+   }
+}
+
+
+#if defined(__SSSE3__) && !defined(__ARM_NEON)
+/// <summary>
+/// pshufb masks that pull one channel of 16 packed pixels out of the 3 or 4
+/// vectors they were loaded from; -1 zeroes the output byte
+/// </summary>
+struct ChannelShuffle {
+   int8_t mask[4][16];
+};
+
+constexpr ChannelShuffle makeChannelShuffle(int bytesPerPixel, int channel)
+{
+   ChannelShuffle shuffle = {};
+   for (int load=0; load<4; ++load)
+      for (int lane=0; lane<16; ++lane)
+         shuffle.mask[load][lane] = -1;
+   for (int lane=0; lane<16; ++lane)
+   {
+      int index = lane * bytesPerPixel + channel;
+      shuffle.mask[index / 16][lane] = (int8_t)(index % 16);
+   }
+   return shuffle;
+}
+
+template <int Loads>
+inline __m128i gatherChannel(const __m128i *v, const ChannelShuffle &shuffle)
+{
+   __m128i channel = _mm_shuffle_epi8(v[0], _mm_loadu_si128((const __m128i *)shuffle.mask[0]));
+   for (int load=1; load<Loads; ++load)
+      channel = _mm_or_si128(channel, _mm_shuffle_epi8(v[load], _mm_loadu_si128((const __m128i *)shuffle.mask[load])));
+   return channel;
+}
+#endif
+
+
+#endif
@@ -0,0 +1,292 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <algorithm>
+#include "PackedPixels.h"
+#include "ProfileDetector.h"
+
+
+/// <summary>
+/// Initializes a new instance of class ProfileDetector for frames up to the
+/// given size
+/// </summary>
+ProfileDetector::ProfileDetector(int width, int height)
+{
+   this->width = width;
+   this->height = height;
+
+   columnProfile.resize(width);
+   rowProfile.resize(height);
+   bandColumnSums.resize(width);
+}
+
+
+/// <summary>
+/// Returns true if we know how to profile the given format
+/// </summary>
+bool ProfileDetector::isFormatSupported(PixelFormat format)
+{
+   return isPackedRGB(format);
+}
+
+
+/// <summary>
+/// Finds the peak of the given range of a profile, and returns its weighted
+/// centroid, which gives us sub-pixel resolution; returns false if the range
+/// is all zero.  The peak is the run around the highest value that stays
+/// above a fraction of it, so the tail of anything else that's red along the
+/// same rows or columns doesn't get averaged in unless it's right next door.
+/// </summary>
+bool ProfileDetector::findPeak(const uint32_t *profile, int begin, int end, float &position)
+{
+   int highest = begin;
+   for (int i=begin; i<end; ++i)
+      if (profile[i] > profile[highest])
+         highest = i;
+   if (highest >= end || profile[highest] == 0)
+      return false;
+
+   uint32_t threshold = profile[highest] / PeakThresholdDivisor;
+   int first = highest;
+   int last = highest;
+   while (first > begin && profile[first - 1] > threshold)
+      --first;
+   while (last + 1 < end && profile[last + 1] > threshold)
+      ++last;
+
+   uint64_t sum = 0;
+   uint64_t weightedSum = 0;
+   for (int i=first; i<=last; ++i)
+   {
+      sum += profile[i];
+      weightedSum += (uint64_t)profile[i] * i;
+   }
+   position = (float)((double)weightedSum / sum);
+   return true;
+}
+
+
+/// <summary>
+/// Profiles the given window of a frame of the given format; the window has
+/// to be clipped to the frame already
+/// </summary>
+void ProfileDetector::scan(const FrameFormat &format, const uint8_t *pixelData, const ScanWindow &window)
+{
+   result = DotScanResult();
+   this->window = window;
+   this->window.right = std::min(window.right, width);
+   this->window.bottom = std::min(window.bottom, height);
+   if (this->window.getArea() <= 0)
+   {
+      this->window = ScanWindow();
+      return;
+   }
+   result.pixelsScanned = this->window.getArea();
+   result.samplesScanned = 3 * result.pixelsScanned;
+
+   const uint8_t *plane = pixelData + format.planeOffset[0];
+   int stride = format.planeStride[0];
+   if (!dispatchPackedRGB(format.pixelFormat, [&](auto packed) { scanRows<decltype(packed)::value>(plane, stride); }))
+   {
+      this->window = ScanWindow();
+      return;
+   }
+
+   // the moments come straight from the profiles, so the totals are the same
+   // as DotDetector would give us
+   for (int x=this->window.left; x<this->window.right; ++x)
+      result.weightedXSum += (uint64_t)columnProfile[x] * x;
+   for (int y=this->window.top; y<this->window.bottom; ++y)
+   {
+      result.weightSum += rowProfile[y];
+      result.weightedYSum += (uint64_t)rowProfile[y] * y;
+   }
+}
+
+
+/// <summary>
+/// Profiles every row of the window.  Columns are summed in bands of rows
+/// narrow enough that 16 bits can't overflow, which halves the memory we
+/// touch per pixel, and added to the profile at the end of each band.
+/// </summary>
+template <PixelFormat Format>
+void ProfileDetector::scanRows(const uint8_t *plane, int stride)
+{
+   std::fill(&columnProfile[window.left], &columnProfile[window.left] + (window.right - window.left), 0);
+   std::fill(&bandColumnSums[window.left], &bandColumnSums[window.left] + (window.right - window.left), 0);
+
+   int bandRows = 0;
+   for (int y=window.top; y<window.bottom; ++y)
+   {
+      scanRow<Format>(plane + stride * y, y);
+      if (++bandRows == RowsPerBand)
+      {
+         flushColumns();
+         bandRows = 0;
+      }
+   }
+   flushColumns();
+}
+
+
+/// <summary>
+/// Profiles part of a row of packed RGB pixels, counting hits and saturated
+/// samples as we go.  NEON and SSSE3 builds take 16 pixels at a time and leave
+/// the rest of the row to the scalar loop.
+/// </summary>
+template <PixelFormat Format>
+void ProfileDetector::scanRow(const uint8_t *row, int y)
+{
+   using Layout = PackedLayout<Format>;
+   constexpr int BytesPerPixel = Layout::BytesPerPixel;
+
+   uint16_t *columnSums = &bandColumnSums[0];
+   uint32_t rowSum = 0;
+   int x = window.left;
+   int right = window.right;
+
+#if defined(__ARM_NEON)
+
+   // pairwise accumulation into 16 bits holds 128 iterations of 2 * 255,
+   // which is a row of 2048 pixels
+   const uint8x16_t saturated = vdupq_n_u8(255);
+   const uint8x16_t one = vdupq_n_u8(1);
+   uint16x8_t saturatedCounts = vdupq_n_u16(0);
+   uint16x8_t hitCounts = vdupq_n_u16(0);
+   uint16x8_t rowSums = vdupq_n_u16(0);
+
+   for (; x + 16 <= right; x += 16)
+   {
+      uint8x16_t r, g, b;
+      if constexpr (BytesPerPixel == 3)
+      {
+         uint8x16x3_t v = vld3q_u8(row + 3 * x);
+         r = v.val[Layout::Red];
+         g = v.val[Layout::Green];
+         b = v.val[Layout::Blue];
+      }
+      else
+      {
+         uint8x16x4_t v = vld4q_u8(row + 4 * x);
+         r = v.val[Layout::Red];
+         g = v.val[Layout::Green];
+         b = v.val[Layout::Blue];
+      }
+
+      uint8x16_t s = vandq_u8(vceqq_u8(r, saturated), one);
+      s = vaddq_u8(s, vandq_u8(vceqq_u8(g, saturated), one));
+      s = vaddq_u8(s, vandq_u8(vceqq_u8(b, saturated), one));
+      saturatedCounts = vpadalq_u8(saturatedCounts, s);
+
+      // r - (g + b), saturating to zero when it isn't red
+      uint8x16_t redness = vqsubq_u8(r, vqaddq_u8(g, b));
+      hitCounts = vpadalq_u8(hitCounts, vminq_u8(redness, one));
+      rowSums = vpadalq_u8(rowSums, redness);
+
+      uint16_t *sums = columnSums + x;
+      vst1q_u16(sums, vaddw_u8(vld1q_u16(sums), vget_low_u8(redness)));
+      vst1q_u16(sums + 8, vaddw_u8(vld1q_u16(sums + 8), vget_high_u8(redness)));
+   }
+
+   auto total = [](uint16x8_t counts) {
+      uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(counts));
+      return (uint32_t)(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+   };
+   result.saturatedCount += total(saturatedCounts);
+   result.hitCount += total(hitCounts);
+   rowSum += total(rowSums);
+
+#elif defined(__SSSE3__)
+
+   static constexpr ChannelShuffle redShuffle = makeChannelShuffle(BytesPerPixel, Layout::Red);
+   static constexpr ChannelShuffle greenShuffle = makeChannelShuffle(BytesPerPixel, Layout::Green);
+   static constexpr ChannelShuffle blueShuffle = makeChannelShuffle(BytesPerPixel, Layout::Blue);
+   const __m128i saturated = _mm_set1_epi8(-1);
+   const __m128i one = _mm_set1_epi8(1);
+   const __m128i zero = _mm_setzero_si128();
+
+   // byte counters, flushed before they can overflow as in DotDetector; the
+   // row sum is in 64-bit lanes, which can't
+   __m128i saturatedCounts = zero;
+   __m128i hitCounts = zero;
+   __m128i rowSums = zero;
+   int iterationsUntilFlush = 80;
+   auto flush = [&]() {
+      __m128i saturatedSums = _mm_sad_epu8(saturatedCounts, zero);
+      __m128i hitSums = _mm_sad_epu8(hitCounts, zero);
+      result.saturatedCount += _mm_cvtsi128_si32(saturatedSums) + _mm_extract_epi16(saturatedSums, 4);
+      result.hitCount += _mm_cvtsi128_si32(hitSums) + _mm_extract_epi16(hitSums, 4);
+      saturatedCounts = zero;
+      hitCounts = zero;
+      iterationsUntilFlush = 80;
+   };
+
+   for (; x + 16 <= right; x += 16)
+   {
+      const __m128i *p = (const __m128i *)(row + BytesPerPixel * x);
+      __m128i v[BytesPerPixel];
+      for (int load=0; load<BytesPerPixel; ++load)
+         v[load] = _mm_loadu_si128(p + load);
+
+      __m128i r = gatherChannel<BytesPerPixel>(v, redShuffle);
+      __m128i g = gatherChannel<BytesPerPixel>(v, greenShuffle);
+      __m128i b = gatherChannel<BytesPerPixel>(v, blueShuffle);
+
+      saturatedCounts = _mm_sub_epi8(saturatedCounts, _mm_cmpeq_epi8(r, saturated));
+      saturatedCounts = _mm_sub_epi8(saturatedCounts, _mm_cmpeq_epi8(g, saturated));
+      saturatedCounts = _mm_sub_epi8(saturatedCounts, _mm_cmpeq_epi8(b, saturated));
+
+      // r - (g + b), saturating to zero when it isn't red
+      __m128i redness = _mm_subs_epu8(r, _mm_adds_epu8(g, b));
+      hitCounts = _mm_add_epi8(hitCounts, _mm_min_epu8(redness, one));
+      rowSums = _mm_add_epi64(rowSums, _mm_sad_epu8(redness, zero));
+
+      __m128i *sums = (__m128i *)(columnSums + x);
+      _mm_storeu_si128(sums, _mm_add_epi16(_mm_loadu_si128(sums), _mm_unpacklo_epi8(redness, zero)));
+      _mm_storeu_si128(sums + 1, _mm_add_epi16(_mm_loadu_si128(sums + 1), _mm_unpackhi_epi8(redness, zero)));
+
+      if (--iterationsUntilFlush == 0)
+         flush();
+   }
+
+   flush();
+   rowSum += (uint32_t)_mm_cvtsi128_si32(_mm_add_epi64(rowSums, _mm_srli_si128(rowSums, 8)));
+
+#endif
+
+   // whatever is left over, or everything if we have no vector support
+   for (; x < right; ++x)
+   {
+      const uint8_t *p = row + BytesPerPixel * x;
+      int r = p[Layout::Red];
+      int g = p[Layout::Green];
+      int b = p[Layout::Blue];
+      result.saturatedCount += (r == 255) + (g == 255) + (b == 255);
+      if (r > g + b)
+      {
+         int redness = r - g - b;
+         ++result.hitCount;
+         rowSum += redness;
+         columnSums[x] += (uint16_t)redness;
+      }
+   }
+
+   rowProfile[y] = rowSum;
+}
+
+
+/// <summary>
+/// Adds the current band's column sums to the column profile and starts a new
+/// band
+/// </summary>
+void ProfileDetector::flushColumns()
+{
+   for (int x=window.left; x<window.right; ++x)
+   {
+      columnProfile[x] += bandColumnSums[x];
+      bandColumnSums[x] = 0;
+   }
+}
@@ -0,0 +1,80 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef PROFILEDETECTOR_H
+#define PROFILEDETECTOR_H
+
+#include <stdint.h>
+#include <vector>
+#include "DotDetector.h"
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// Finds the dot from projections of the frame's redness onto its rows and
+/// columns, rather than from a list of hits.  Every pixel's redness, r - (g +
+/// b) or zero if that's negative, is added to the profile of its row and the
+/// profile of its column in one streaming pass, and the dot is where the two
+/// profiles peak.  Working memory is a counter per row and per column, which
+/// stays in L1, and the time a scan takes doesn't depend on what's in the
+/// frame, however much of it is red.
+///
+/// The catch is that the two profiles are independent: two red things that
+/// are apart in both x and y make two peaks in each, and we go with the
+/// strongest of each, which is usually but not necessarily the same thing.
+///
+/// Only packed RGB formats are supported, vectorized the same way as
+/// DotDetector's kernels.
+/// </summary>
+class ProfileDetector
+{
+public:
+   ProfileDetector(int width, int height);
+
+   static bool isFormatSupported(PixelFormat format);
+   static bool findPeak(const uint32_t *profile, int begin, int end, float &position);
+
+   void scan(const FrameFormat &format, const uint8_t *pixelData, const ScanWindow &window);
+
+   // the result of the last scan; its weights are the pixels' redness, the
+   // same as DotDetector's
+   const DotScanResult &getResult() const { return result; }
+
+   // the profiles, which are only valid within the last scan's window
+   const ScanWindow &getWindow() const { return window; }
+   const uint32_t *getColumnProfile() const { return &columnProfile[0]; }
+   const uint32_t *getRowProfile() const { return &rowProfile[0]; }
+
+private:
+   // columns are summed 16 bits wide, which holds this many rows of 255
+   static constexpr int RowsPerBand = 257;
+
+   // the peak of a profile is everything around its highest point that's
+   // more than this fraction of it
+   static constexpr int PeakThresholdDivisor = 8;
+
+private:
+   template <PixelFormat Format> void scanRows(const uint8_t *plane, int stride);
+   template <PixelFormat Format> void scanRow(const uint8_t *row, int y);
+   void flushColumns();
+
+private:
+   // the largest frame we're set up for
+   int width;
+   int height;
+
+   ScanWindow window;
+   DotScanResult result;
+
+   // allocated once at construction and never resized, so that scanning a
+   // frame never touches the heap
+   std::vector<uint32_t> columnProfile;
+   std::vector<uint32_t> rowProfile;
+   std::vector<uint16_t> bandColumnSums;
+};
+
+
+#endif
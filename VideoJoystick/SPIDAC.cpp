@@ -11,6 +11,7 @@
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>
 #include "SPIDAC.h"
+#include "Statistics.h"
 
 
 // documentation break
@@ -58,7 +59,10 @@ void SPIDAC::open()
    fileDescriptor = ::open(SPI_CHANNEL_0_PATH, O_RDWR);
    if (fileDescriptor == -1)
    {
-      std::cout << "SPIDAC: open failed" << std::endl;
+      // we get called again for every write, which is a lot of complaining
+      if (!openFailureReported)
+         std::cout << "SPIDAC: open failed" << std::endl;
+      openFailureReported = true;
       return;
    }
 
@@ -96,11 +100,12 @@ void SPIDAC::sendY(float y)
 }
 
 
-void SPIDAC::sendDacCommand(DacCommand command, float dacValue)
+/// <summary>
+/// makes the two byte packet for the given command, with a dacValue from 0
+/// to 1 scaled to the DAC's 10 bits
+/// </summary>
+void SPIDAC::encodeDacCommand(DacCommand command, float dacValue, uint8_t packet[2])
 {
-   // open if we haven't already
-   open();
-
    // convert the dacValue into an integer from 0 to 1023
    uint16_t iDacValue = 0;
    if (dacValue < 0)
@@ -110,11 +115,24 @@ void SPIDAC::sendDacCommand(DacCommand command, float dacValue)
    else
       iDacValue = (uint16_t)(1023 * dacValue + 0.5);
 
+   packet[0] = (uint8_t)(((uint8_t)command << 4) | (iDacValue >> 6));
+   packet[1] = (uint8_t)(iDacValue << 2);
+}
+
+
+void SPIDAC::sendDacCommand(DacCommand command, float dacValue)
+{
+   // open if we haven't already
+   open();
+   if (fileDescriptor == -1)
+   {
+      Statistics::getInstance()->increment(Statistic::SpiErrors);
+      return;
+   }
+
    // make our packet
-   uint8_t data[] = {
-      (uint8_t)(((uint8_t)command << 4) | (iDacValue >> 6)),
-      (uint8_t)(iDacValue << 2)
-   };
+   uint8_t data[2];
+   encodeDacCommand(command, dacValue, data);
 
    struct spi_ioc_transfer spi_message[1];
    memset(spi_message, 0, sizeof(spi_message));
@@ -124,5 +142,5 @@ void SPIDAC::sendDacCommand(DacCommand command, float dacValue)
    // on RPi3B this takes about 2ms
    int result = ioctl(fileDescriptor, SPI_IOC_MESSAGE(1), spi_message);
    if (result == -1)
-      std::cout << "sendX: ioctl failed" << std::endl;
+      Statistics::getInstance()->increment(Statistic::SpiErrors);
 }
@@ -23,7 +23,7 @@ public:
    void sendX(float x);
    void sendY(float y);
 
-private:
+public:
    enum class DacCommand : uint8_t {
       NoOp = 0,
       LoadANoUpdate = 1,
@@ -43,12 +43,15 @@ private:
       UpdateAndWake = 15
    };
 
+   static void encodeDacCommand(DacCommand command, float dacValue, uint8_t packet[2]);
+
 private:
    void open();
    void sendDacCommand(DacCommand command, float dacValue);
 
 private:
    int fileDescriptor = -1;
+   bool openFailureReported = false;
 };
 
 #endif
@@ -0,0 +1,109 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <cstdio>
+#include "Statistics.h"
+
+
+/// <summary>
+/// Initializes a new instance of class Statistics
+/// </summary>
+Statistics::Statistics()
+{
+   windowStart = std::chrono::steady_clock::now();
+}
+
+
+/// <summary>
+/// gets the global singleton
+/// </summary>
+Statistics *Statistics::getInstance()
+{
+   static Statistics instance;
+   return &instance;
+}
+
+
+/// <summary>
+/// Returns the given counter's rate per second over the last complete window
+/// </summary>
+double Statistics::getRate(Statistic statistic)
+{
+   std::lock_guard<std::mutex> lock(rateMutex);
+   return rates[(int)statistic];
+}
+
+
+/// <summary>
+/// Returns the name of a counter
+/// </summary>
+const char *Statistics::getName(Statistic statistic)
+{
+   switch (statistic)
+   {
+   case Statistic::FramesCompleted: return "framesCompleted";
+   case Statistic::FramesCancelled: return "framesCancelled";
+   case Statistic::FramesProcessed: return "framesProcessed";
+   case Statistic::FramesDisplaced: return "framesDisplaced";
+   case Statistic::FramesMissed: return "framesMissed";
+   case Statistic::FramesLate: return "framesLate";
+   case Statistic::DotFound: return "dotFound";
+   case Statistic::DotNotFound: return "dotNotFound";
+   case Statistic::SpiErrors: return "spiErrors";
+   case Statistic::Count: break;
+   }
+   return "";
+}
+
+
+/// <summary>
+/// Closes the current rate window if it's been open long enough; call this
+/// periodically, more often than the window length
+/// </summary>
+void Statistics::sample()
+{
+   std::lock_guard<std::mutex> lock(rateMutex);
+
+   auto now = std::chrono::steady_clock::now();
+   auto elapsed = now - windowStart;
+   if (elapsed < RateWindow)
+      return;
+
+   double seconds = std::chrono::duration<double>(elapsed).count();
+   for (int i=0; i<(int)Statistic::Count; ++i)
+   {
+      uint64_t count = get((Statistic)i);
+      rates[i] = (count - windowStartCounts[i]) / seconds;
+      windowStartCounts[i] = count;
+   }
+   windowStart = now;
+}
+
+
+/// <summary>
+/// Formats the counters for our command line, as "name=total,rate" for each
+/// counter, separated by semicolons, rates being per second
+/// </summary>
+std::string Statistics::toString()
+{
+   std::lock_guard<std::mutex> lock(rateMutex);
+
+   std::string result;
+   for (int i=0; i<(int)Statistic::Count; ++i)
+   {
+      char rate[32];
+      snprintf(rate, sizeof(rate), "%.1f", rates[i]);
+
+      if (!result.empty())
+         result += ";";
+      result += getName((Statistic)i);
+      result += "=";
+      result += std::to_string(get((Statistic)i));
+      result += ",";
+      result += rate;
+   }
+   return result;
+}
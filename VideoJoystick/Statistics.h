@@ -0,0 +1,77 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+
+/// <summary>
+/// Things we count
+/// </summary>
+enum class Statistic {
+   FramesCompleted,     // the camera gave us a frame
+   FramesCancelled,     // the camera gave us back a request without one
+   FramesProcessed,     // a frame went to the frame callback
+   FramesDisplaced,     // a frame was dropped because we weren't keeping up
+   FramesMissed,        // gaps in the camera's frame numbers
+   FramesLate,          // a frame's results were delivered after a later one's
+   DotFound,            // we found the dot in a frame
+   DotNotFound,         // we looked and didn't find it
+   SpiErrors,           // a write to the DAC failed
+   Count
+};
+
+
+/// <summary>
+/// Global counters that anything can bump from any thread; each lives on its
+/// own cache line, so that threads counting different things don't fight
+/// over them, and counting is a relaxed atomic add.  Rates are computed over
+/// windows of at least a second by whoever calls sample, which should be
+/// some thread that isn't in a hurry.
+/// </summary>
+class Statistics final
+{
+private:
+   // single instance; constructor is private
+   Statistics();
+
+public:
+   static Statistics *getInstance();
+
+   void increment(Statistic statistic, uint64_t count = 1) { counters[(int)statistic].value.fetch_add(count, std::memory_order_relaxed); }
+   uint64_t get(Statistic statistic) const { return counters[(int)statistic].value.load(std::memory_order_relaxed); }
+   double getRate(Statistic statistic);
+   static const char *getName(Statistic statistic);
+
+   void sample();
+   std::string toString();
+
+private:
+   static constexpr std::chrono::milliseconds RateWindow { 1000 };
+
+   struct alignas(64) Counter {
+      std::atomic<uint64_t> value { 0 };
+   };
+
+private:
+   Counter counters[(int)Statistic::Count];
+
+   // the rates over the last complete window, and the counts at the start of
+   // the current one
+   std::mutex rateMutex;
+   std::chrono::steady_clock::time_point windowStart;
+   uint64_t windowStartCounts[(int)Statistic::Count] = {};
+   double rates[(int)Statistic::Count] = {};
+};
+
+
+#endif
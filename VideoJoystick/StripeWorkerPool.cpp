@@ -0,0 +1,108 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include "StripeWorkerPool.h"
+
+
+/// <summary>
+/// Initializes a new instance of class StripeWorkerPool
+/// </summary>
+StripeWorkerPool::StripeWorkerPool(int stripeCount, const std::function<void(int)> &work)
+{
+   if (stripeCount < 1)
+      stripeCount = 1;
+   this->stripeCount = stripeCount;
+   this->work = work;
+
+   // stripe zero belongs to whoever calls run
+   for (int stripe=1; stripe<stripeCount; ++stripe)
+      threads.push_back(new std::thread([this, stripe]() { workerThread(stripe); }));
+}
+
+
+/// <summary>
+/// Releases resources held by the object
+/// </summary>
+StripeWorkerPool::~StripeWorkerPool()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      terminated = true;
+      workAvailable.notify_all();
+   }
+
+   for (auto thread : threads)
+   {
+      thread->join();
+      delete thread;
+   }
+}
+
+
+/// <summary>
+/// Runs the work function on the given number of stripes, returning when
+/// they have all completed
+/// </summary>
+void StripeWorkerPool::run(int activeStripes)
+{
+   if (activeStripes > stripeCount)
+      activeStripes = stripeCount;
+
+   // if there's only one stripe there's no point in bothering anyone
+   if (activeStripes <= 1)
+   {
+      work(0);
+      return;
+   }
+
+   // kick off the other stripes
+   stripesRemaining = activeStripes - 1;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      this->activeStripes = activeStripes;
+      ++generation;
+      workAvailable.notify_all();
+   }
+
+   // do our part
+   work(0);
+
+   // and wait for everyone else; they should be about as fast as we were, so
+   // there's no point in going to sleep
+   while (stripesRemaining.load(std::memory_order_acquire) != 0)
+      std::this_thread::yield();
+}
+
+
+/// <summary>
+/// Our worker threads; each waits for a new generation of work and then does
+/// its stripe
+/// </summary>
+void StripeWorkerPool::workerThread(int stripe)
+{
+   uint64_t lastGeneration = 0;
+
+   for (;;)
+   {
+      // wait for something to do
+      int active;
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         workAvailable.wait(lock, [&]() { return terminated || generation != lastGeneration; });
+         if (terminated)
+            return;
+         lastGeneration = generation;
+         active = activeStripes;
+      }
+
+      // do it if this generation includes us
+      if (stripe < active)
+      {
+         work(stripe);
+         stripesRemaining.fetch_sub(1, std::memory_order_release);
+      }
+   }
+}
@@ -0,0 +1,55 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef STRIPEWORKERPOOL_H
+#define STRIPEWORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/// <summary>
+/// A persistent set of threads for splitting a frame into horizontal stripes
+/// and working on them in parallel.  The thread that calls run() takes stripe
+/// zero itself and the pool's threads take the rest, so a pool of N stripes
+/// has N-1 threads.  Nothing is allocated and no threads are created after
+/// construction; each stripe's work function is expected to write its
+/// results somewhere of its own so that there's nothing to lock.
+/// </summary>
+class StripeWorkerPool final
+{
+public:
+   StripeWorkerPool(int stripeCount, const std::function<void(int)> &work);
+   ~StripeWorkerPool();
+
+   int getStripeCount() const { return stripeCount; }
+   void run(int activeStripes);
+
+private:
+   void workerThread(int stripe);
+
+private:
+   int stripeCount;
+   std::function<void(int)> work;
+   std::vector<std::thread *> threads;
+
+   // a new generation means there's new work; the mutex is only for the
+   // benefit of sleeping and waking the threads
+   std::mutex mutex;
+   std::condition_variable workAvailable;
+   uint64_t generation = 0;
+   int activeStripes = 0;
+   bool terminated = false;
+
+   std::atomic<int> stripesRemaining { 0 };
+};
+
+
+#endif
@@ -0,0 +1,485 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include "Statistics.h"
+#include "SyntheticFrameGrabber.h"
+
+
+/// <summary>
+/// How much of a pixel at the given distance from the middle of a disc is
+/// covered by it, when its edge fades out over the blur distance
+/// </summary>
+static float getCoverage(float distance, float radius, float blur)
+{
+   if (blur <= 0)
+      return distance <= radius ? 1.0f : 0.0f;
+   return std::min(1.0f, std::max(0.0f, (radius + blur / 2 - distance) / blur));
+}
+
+
+/// <summary>
+/// Returns the color filter pattern of a Bayer format, in the order top
+/// left, top right, bottom left, bottom right
+/// </summary>
+static const char *getBayerPattern(PixelFormat pixelFormat)
+{
+   switch (pixelFormat)
+   {
+   case PixelFormat::BayerRGGB10:
+   case PixelFormat::BayerRGGB10Packed:
+      return "RGGB";
+   case PixelFormat::BayerGRBG10:
+   case PixelFormat::BayerGRBG10Packed:
+      return "GRBG";
+   case PixelFormat::BayerGBRG10:
+   case PixelFormat::BayerGBRG10Packed:
+      return "GBRG";
+   default:
+      return "BGGR";
+   }
+}
+
+
+/// <summary>
+/// Initializes a new instance of class SyntheticFrameGrabber, rendering the
+/// scene's backgrounds and creating frameCount frames for it to draw in
+/// </summary>
+SyntheticFrameGrabber::SyntheticFrameGrabber(const SyntheticScene &scene, const FrameDispatcher::Settings &dispatchSettings, int frameCount)
+   : scene(scene)
+{
+   // the chroma planes and Bayer cells need even dimensions, and packed
+   // Bayer rows whole groups of 4
+   if (scene.width < 4 || scene.height < 2)
+      throw std::invalid_argument("SyntheticFrameGrabber: frame too small");
+   this->scene.width &= (scene.pixelFormat >= PixelFormat::BayerRGGB10Packed) ? ~3 : ~1;
+   this->scene.height &= ~1;
+   format = FrameFormat::create(scene.pixelFormat, this->scene.width, this->scene.height, scene.stride);
+
+   renderBackgrounds();
+   scratchRGB = backgroundRGB[0];
+
+   if (frameCount < 1)
+      frameCount = 1;
+   frameBusy.reset(new std::atomic<bool>[frameCount]);
+   for (int i=0; i<frameCount; ++i)
+   {
+      std::unique_ptr<VideoFrame> frame(new SyntheticVideoFrame(getFrameLength()));
+      frame->setFormat(format);
+      framePool->addFrame(std::move(frame));
+      frameBusy[i] = false;
+   }
+
+   frameDispatcher.reset(new FrameDispatcher(
+      dispatchSettings,
+      [this](int slot, uint64_t sequence) { processFrame(slot, sequence); },
+      [this](int slot)
+      {
+         Statistics::getInstance()->increment(Statistic::FramesDisplaced);
+         onFrameReturned(slot);
+      }
+      ));
+}
+
+
+/// <summary>
+/// Releases resources held by the object
+/// </summary>
+SyntheticFrameGrabber::~SyntheticFrameGrabber()
+{
+   terminated = true;
+   if (renderThread.joinable())
+      renderThread.join();
+   frameDispatcher->stop();
+
+   // wait for whoever's still holding frames to let go; if they don't, the
+   // pool has to outlive us
+   if (!framePool->drain())
+   {
+      std::cerr << "SyntheticFrameGrabber: frames still held at shutdown, leaking them" << std::endl;
+      framePool.release();
+   }
+}
+
+
+/// <summary>
+/// Starts delivering frames to the callback
+/// </summary>
+void SyntheticFrameGrabber::startCapturing()
+{
+   if (renderThread.joinable())
+      return;
+   renderThread = std::thread([this]() { renderFrames(); });
+}
+
+
+/// <summary>
+/// Returns where the middle of the dot is in the given frame
+/// </summary>
+void SyntheticFrameGrabber::getDotPosition(uint64_t cameraSequence, float &x, float &y) const
+{
+   const double TwoPi = 2 * M_PI;
+   double t = (double)cameraSequence;
+   x = scene.centerX + (scene.periodX > 0 ? scene.amplitudeX * (float)std::sin(TwoPi * t / scene.periodX) : 0.0f);
+   y = scene.centerY + (scene.periodY > 0 ? scene.amplitudeY * (float)std::cos(TwoPi * t / scene.periodY) : 0.0f);
+}
+
+
+/// <summary>
+/// Renders the given frame of the scene into a frame of its own, outside the
+/// pool, for when we want the pictures without the camera; not to be used
+/// while we're capturing
+/// </summary>
+std::shared_ptr<VideoFrame> SyntheticFrameGrabber::renderFrame(uint64_t cameraSequence)
+{
+   auto frame = std::make_shared<SyntheticVideoFrame>(getFrameLength());
+   draw(frame->getWritablePixelData(), cameraSequence);
+   frame->setFormat(format);
+   frame->setCameraSequence(cameraSequence);
+   return frame;
+}
+
+
+/// <summary>
+/// Renders the background, distractors and noise, in RGB and in our pixel
+/// format
+/// </summary>
+void SyntheticFrameGrabber::renderBackgrounds()
+{
+   int width = scene.width;
+   int height = scene.height;
+
+   // everything that holds still
+   std::vector<float> clean(3 * width * height);
+   for (int y=0; y<height; ++y)
+   {
+      for (int x=0; x<width; ++x)
+      {
+         float r = scene.backgroundR, g = scene.backgroundG, b = scene.backgroundB;
+         for (const SyntheticObject &object : scene.distractors)
+         {
+            float coverage = getCoverage(std::hypot(x - object.x, y - object.y), object.radius, 1.0f);
+            r += coverage * (object.r - r);
+            g += coverage * (object.g - g);
+            b += coverage * (object.b - b);
+         }
+
+         float *pixel = &clean[3 * (y * width + x)];
+         pixel[0] = r;
+         pixel[1] = g;
+         pixel[2] = b;
+      }
+   }
+
+   // then a different helping of noise for each variation
+   std::mt19937 random(scene.seed);
+   std::normal_distribution<float> gaussian(0, scene.noise > 0 ? scene.noise : 1);
+   Box frameBox = { 0, 0, width, height };
+   for (int i=0; i<BackgroundCount; ++i)
+   {
+      std::vector<uint8_t> &rgb = backgroundRGB[i];
+      rgb.resize(clean.size());
+      for (size_t j=0; j<clean.size(); ++j)
+      {
+         float value = clean[j] + (scene.noise > 0 ? gaussian(random) : 0);
+         rgb[j] = (uint8_t)std::lround(std::min(255.0f, std::max(0.0f, value)));
+      }
+
+      backgroundPixels[i].assign(getFrameLength(), 0);
+      encode(rgb.data(), frameBox, backgroundPixels[i].data());
+   }
+}
+
+
+/// <summary>
+/// Thread that renders frames and posts them to the dispatcher, as the
+/// camera's thread would
+/// </summary>
+void SyntheticFrameGrabber::renderFrames()
+{
+   bool paced = scene.frameRate > 0;
+   auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(paced ? 1.0 / scene.frameRate : 0));
+   auto due = std::chrono::steady_clock::now();
+   int frameCount = framePool->getCapacity();
+
+   for (uint64_t cameraSequence=0; !terminated; ++cameraSequence)
+   {
+      // wait until the frame is due, but if we've fallen more than a frame
+      // behind don't try to catch up
+      if (paced)
+      {
+         std::this_thread::sleep_until(due);
+         due += interval;
+         auto now = std::chrono::steady_clock::now();
+         if (now > due + interval)
+            due = now;
+      }
+
+      // grab a frame to draw in; a camera would skip the frame if there were
+      // none, but if we're not keeping time we may as well wait
+      int slot = -1;
+      while (slot < 0 && !terminated)
+      {
+         for (int i=0; i<frameCount && slot<0; ++i)
+         {
+            bool expected = false;
+            if (frameBusy[i].compare_exchange_strong(expected, true))
+               slot = i;
+         }
+         if (slot >= 0 || paced)
+            break;
+         std::this_thread::yield();
+      }
+      if (slot < 0)
+      {
+         if (!terminated)
+            ++framesSkipped;
+         continue;
+      }
+
+      SyntheticVideoFrame &frame = (SyntheticVideoFrame &)framePool->getFrame(slot);
+      uint64_t timestamp = VideoFrame::getCurrentTimestamp();
+      draw(frame.getWritablePixelData(), cameraSequence);
+
+      frame.setCameraSequence(cameraSequence);
+      frame.setTimestamp(timestamp);
+      frame.setCompletionTimestamp(VideoFrame::getCurrentTimestamp());
+      Statistics::getInstance()->increment(Statistic::FramesCompleted);
+      frameDispatcher->post(slot);
+   }
+}
+
+
+/// <summary>
+/// Draws the given frame of the scene
+/// </summary>
+void SyntheticFrameGrabber::draw(uint8_t *pixelData, uint64_t cameraSequence)
+{
+   int background = (int)(cameraSequence % BackgroundCount);
+   memcpy(pixelData, backgroundPixels[background].data(), backgroundPixels[background].size());
+
+   float dotX, dotY;
+   getDotPosition(cameraSequence, dotX, dotY);
+   renderDot(pixelData, background, dotX, dotY);
+}
+
+
+/// <summary>
+/// Draws the dot over the given background, touching only the pixels around
+/// it
+/// </summary>
+void SyntheticFrameGrabber::renderDot(uint8_t *pixelData, int background, float dotX, float dotY)
+{
+   float extent = scene.dotRadius + std::max(0.0f, scene.dotBlur) / 2 + 1;
+   Box box = alignBox({
+      (int)std::floor(dotX - extent),
+      (int)std::floor(dotY - extent),
+      (int)std::ceil(dotX + extent) + 1,
+      (int)std::ceil(dotY + extent) + 1
+      });
+   if (box.left >= box.right || box.top >= box.bottom)
+      return;
+
+   // the dot's brightness falls off with its coverage; beyond full brightness
+   // its channels clip and it goes white
+   const float color[3] = { (float)scene.dotR, (float)scene.dotG, (float)scene.dotB };
+   const std::vector<uint8_t> &rgb = backgroundRGB[background];
+   for (int y=box.top; y<box.bottom; ++y)
+   {
+      for (int x=box.left; x<box.right; ++x)
+      {
+         size_t index = 3 * ((size_t)y * scene.width + x);
+         float coverage = getCoverage(std::hypot(x - dotX, y - dotY), scene.dotRadius, scene.dotBlur);
+         float intensity = coverage * scene.dotBrightness;
+         for (int channel=0; channel<3; ++channel)
+         {
+            float dot = color[channel] * intensity + std::max(0.0f, intensity - 1) * 255;
+            float value = rgb[index + channel] * (1 - coverage) + dot;
+            scratchRGB[index + channel] = (uint8_t)std::min(255.0f, value + 0.5f);
+         }
+      }
+   }
+
+   encode(scratchRGB.data(), box, pixelData);
+}
+
+
+/// <summary>
+/// Converts a box of RGB pixels into our pixel format; the box has to be
+/// aligned with alignBox
+/// </summary>
+void SyntheticFrameGrabber::encode(const uint8_t *rgb, const Box &box, uint8_t *pixelData) const
+{
+   int width = scene.width;
+   int stride = format.planeStride[0];
+   uint8_t *plane = pixelData + format.planeOffset[0];
+
+   switch (format.pixelFormat)
+   {
+   case PixelFormat::BGR24:
+   case PixelFormat::RGB24:
+   case PixelFormat::XRGB8888:
+      {
+         bool bgr = format.pixelFormat != PixelFormat::RGB24;
+         int bytesPerPixel = format.pixelFormat == PixelFormat::XRGB8888 ? 4 : 3;
+         for (int y=box.top; y<box.bottom; ++y)
+         {
+            for (int x=box.left; x<box.right; ++x)
+            {
+               const uint8_t *source = &rgb[3 * ((size_t)y * width + x)];
+               uint8_t *pixel = plane + (size_t)y * stride + bytesPerPixel * x;
+               pixel[0] = bgr ? source[2] : source[0];
+               pixel[1] = source[1];
+               pixel[2] = bgr ? source[0] : source[2];
+               if (bytesPerPixel == 4)
+                  pixel[3] = 255;
+            }
+         }
+      }
+      break;
+
+   case PixelFormat::YUV420:
+      {
+         // full range BT.601, U and V from the average of each 2x2 block
+         uint8_t *uPlane = pixelData + format.planeOffset[1];
+         uint8_t *vPlane = pixelData + format.planeOffset[2];
+         for (int y=box.top; y<box.bottom; y+=2)
+         {
+            for (int x=box.left; x<box.right; x+=2)
+            {
+               float r = 0, g = 0, b = 0;
+               for (int dy=0; dy<2; ++dy)
+               {
+                  for (int dx=0; dx<2; ++dx)
+                  {
+                     const uint8_t *source = &rgb[3 * ((size_t)(y + dy) * width + x + dx)];
+                     plane[(size_t)(y + dy) * stride + x + dx] = (uint8_t)std::lround(0.299f * source[0] + 0.587f * source[1] + 0.114f * source[2]);
+                     r += source[0];
+                     g += source[1];
+                     b += source[2];
+                  }
+               }
+               r /= 4;
+               g /= 4;
+               b /= 4;
+               float u = 128 - 0.168736f * r - 0.331264f * g + 0.5f * b;
+               float v = 128 + 0.5f * r - 0.418688f * g - 0.081312f * b;
+               uPlane[(size_t)(y / 2) * format.planeStride[1] + x / 2] = (uint8_t)std::lround(std::min(255.0f, std::max(0.0f, u)));
+               vPlane[(size_t)(y / 2) * format.planeStride[2] + x / 2] = (uint8_t)std::lround(std::min(255.0f, std::max(0.0f, v)));
+            }
+         }
+      }
+      break;
+
+   default:
+      {
+         // each photosite gets its own color's sample, scaled up to 10 bits
+         const char *pattern = getBayerPattern(format.pixelFormat);
+         bool packed = format.pixelFormat >= PixelFormat::BayerRGGB10Packed;
+         auto getSample = [&](int x, int y)
+         {
+            if (x >= width)
+               return 0;
+            char color = pattern[2 * (y & 1) + (x & 1)];
+            int value = rgb[3 * ((size_t)y * width + x) + (color == 'R' ? 0 : color == 'G' ? 1 : 2)];
+            return (value << 2) | (value >> 6);
+         };
+
+         for (int y=box.top; y<box.bottom; ++y)
+         {
+            uint8_t *row = plane + (size_t)y * stride;
+            if (packed)
+            {
+               for (int x=box.left; x<box.right; x+=4)
+               {
+                  uint8_t *group = row + 5 * (x / 4);
+                  uint8_t lowBits = 0;
+                  for (int i=0; i<4; ++i)
+                  {
+                     int sample = getSample(x + i, y);
+                     group[i] = (uint8_t)(sample >> 2);
+                     lowBits |= (uint8_t)((sample & 3) << (2 * i));
+                  }
+                  group[4] = lowBits;
+               }
+            }
+            else
+            {
+               for (int x=box.left; x<box.right; ++x)
+               {
+                  int sample = getSample(x, y);
+                  row[2 * x] = (uint8_t)sample;
+                  row[2 * x + 1] = (uint8_t)(sample >> 8);
+               }
+            }
+         }
+      }
+      break;
+   }
+}
+
+
+/// <summary>
+/// Grows a box to whole groups of 4 columns and pairs of rows, which covers
+/// what every format needs (2x2 chroma blocks and Bayer cells, and packed
+/// Bayer's groups of 4), and clips it to the frame
+/// </summary>
+SyntheticFrameGrabber::Box SyntheticFrameGrabber::alignBox(Box box) const
+{
+   box.left = std::max(0, box.left) & ~3;
+   box.top = std::max(0, box.top) & ~1;
+   box.right = std::min(scene.width, (box.right + 3) & ~3);
+   box.bottom = std::min(scene.height, (box.bottom + 1) & ~1);
+   return box;
+}
+
+
+/// <summary>
+/// Returns the length of a frame's pixel data
+/// </summary>
+size_t SyntheticFrameGrabber::getFrameLength() const
+{
+   size_t length = 0;
+   for (int plane=0; plane<format.planeCount; ++plane)
+   {
+      int rows = plane == 0 ? format.height : format.height / 2;
+      length = std::max(length, (size_t)format.planeOffset[plane] + (size_t)format.planeStride[plane] * rows);
+   }
+   return length;
+}
+
+
+/// <summary>
+/// Processes the frame in the given slot; called on one of the dispatcher's
+/// threads
+/// </summary>
+void SyntheticFrameGrabber::processFrame(int slot, uint64_t sequence)
+{
+   VideoFrame &pooledFrame = framePool->getFrame(slot);
+   pooledFrame.setSequence(sequence);
+   pooledFrame.setHandoffTimestamp(VideoFrame::getCurrentTimestamp());
+
+   std::shared_ptr<VideoFrame> frame = framePool->lend(slot);
+   Statistics::getInstance()->increment(Statistic::FramesProcessed);
+   if (frameCallback)
+      frameCallback(frame);
+}
+
+
+/// <summary>
+/// Called when a frame is done with, whether it was processed or dropped;
+/// we can draw in it again
+/// </summary>
+void SyntheticFrameGrabber::onFrameReturned(int slot)
+{
+   frameBusy[slot] = false;
+}
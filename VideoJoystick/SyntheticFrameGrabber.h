@@ -0,0 +1,178 @@
+//
+// Author: Randy Rasmussen
+// Copyright: none, use as you will
+// Warantee: none, your own risk
+//
+
+#ifndef SYNTHETICFRAMEGRABBER_H
+#define SYNTHETICFRAMEGRABBER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "FrameDispatcher.h"
+#include "FrameGrabber.h"
+#include "FramePool.h"
+#include "VideoFrame.h"
+
+
+/// <summary>
+/// Something in the scene that isn't the dot but might look like it; the
+/// default is a reddish orange that just misses r > g + b
+/// </summary>
+struct SyntheticObject {
+   float x = 0;
+   float y = 0;
+   float radius = 10;
+   uint8_t r = 200;
+   uint8_t g = 110;
+   uint8_t b = 100;
+};
+
+
+/// <summary>
+/// What a SyntheticFrameGrabber draws.  The dot follows
+///    x = centerX + amplitudeX * sin(2 pi frame / periodX)
+///    y = centerY + amplitudeY * cos(2 pi frame / periodY)
+/// so zero amplitudes hold it still, equal periods make a circle or an
+/// ellipse, and anything else a Lissajous figure.  Periods are in frames so
+/// that where the dot is doesn't depend on how fast we're going.
+/// </summary>
+struct SyntheticScene {
+   PixelFormat pixelFormat = PixelFormat::BGR24;
+   int width = 640;
+   int height = 480;
+   int stride = 0;               // zero for unpadded rows
+   double frameRate = 200;       // zero for as fast as frames are taken
+
+   // a flat background with gaussian noise of the given standard deviation
+   // on every sample
+   uint8_t backgroundR = 70;
+   uint8_t backgroundG = 75;
+   uint8_t backgroundB = 70;
+   float noise = 3;
+
+   // the dot; its edge fades out over the blur distance, and a brightness
+   // above one overexposes it, clipping its channels and washing its middle
+   // out toward white the way a real LED does
+   float dotRadius = 4;
+   float dotBlur = 1.5f;
+   uint8_t dotR = 230;
+   uint8_t dotG = 40;
+   uint8_t dotB = 40;
+   float dotBrightness = 1;
+
+   float centerX = 320;
+   float centerY = 240;
+   float amplitudeX = 200;
+   float amplitudeY = 150;
+   float periodX = 400;
+   float periodY = 400;
+
+   std::vector<SyntheticObject> distractors;
+   uint32_t seed = 1;
+};
+
+
+/// <summary>
+/// FrameGrabber that renders a red dot moving across a scene, so that the
+/// whole pipeline can be run and its accuracy measured without a Pi, a camera
+/// or an LED.  Frames come from a pool and go through a FrameDispatcher just
+/// like a camera's, so queueing policies and pipelining behave the same; if
+/// all the frames are held when the next one is due it's skipped, and shows
+/// up as a gap in the camera sequence numbers.  Where the dot really was in
+/// any frame is given by getDotPosition.
+///
+/// The background, noise and distractors are rendered up front into a few
+/// frames' worth of variations; after that each frame is a copy of one of
+/// them with the dot drawn in, so we can go well past 200fps.
+/// </summary>
+class SyntheticFrameGrabber : public FrameGrabber
+{
+public:
+   SyntheticFrameGrabber(const SyntheticScene &scene, const FrameDispatcher::Settings &dispatchSettings = FrameDispatcher::Settings(), int frameCount = 6);
+   virtual ~SyntheticFrameGrabber();
+
+   void SetupFrameCallback(const std::function<void(const std::shared_ptr<VideoFrame> &)> &callback) override { frameCallback = callback; }
+   void startCapturing() override;
+
+   uint64_t getFramesProcessed() const override { return frameDispatcher->getFramesProcessed(); }
+   uint64_t getFramesDropped() const override { return frameDispatcher->getFramesDropped(); }
+   int getFramesHeld() const override { return framePool->getFramesLent(); }
+   int getMaxFramesHeld() const override { return framePool->getMaxFramesLent(); }
+   uint64_t getTimesPoolExhausted() const override { return framePool->getTimesExhausted(); }
+   std::string getQueuePolicy() const override { return FrameDispatcher::getPolicyName(frameDispatcher->getPolicy()); }
+   int getQueueDepth() const override { return frameDispatcher->getQueueDepth(); }
+   int getMaxQueueDepth() const override { return frameDispatcher->getMaxQueueDepth(); }
+   void resetMaxQueueDepth() override { frameDispatcher->resetMaxQueueDepth(); }
+
+   const SyntheticScene &getScene() const { return scene; }
+   const FrameFormat &getFormat() const { return format; }
+   void getDotPosition(uint64_t cameraSequence, float &x, float &y) const;
+   std::shared_ptr<VideoFrame> renderFrame(uint64_t cameraSequence);
+
+   // frames that were due while every frame in the pool was busy
+   uint64_t getFramesSkipped() const { return framesSkipped; }
+
+private:
+   // how many variations of the background we cycle through, so that the
+   // noise isn't the same in every frame
+   static constexpr int BackgroundCount = 4;
+
+   /// <summary>
+   /// A frame we can draw into
+   /// </summary>
+   class SyntheticVideoFrame : public VideoFrame {
+   public:
+      SyntheticVideoFrame(size_t length) : pixelData(length) {}
+      int getPixelDataLength() const override { return (int)pixelData.size(); }
+      const uint8_t *getPixelData() const override { return pixelData.data(); }
+      uint8_t *getWritablePixelData() { return pixelData.data(); }
+   private:
+      std::vector<uint8_t> pixelData;
+   };
+
+   struct Box {
+      int left, top, right, bottom;
+   };
+
+private:
+   void renderBackgrounds();
+   void renderFrames();
+   void draw(uint8_t *pixelData, uint64_t cameraSequence);
+   void renderDot(uint8_t *pixelData, int background, float dotX, float dotY);
+   void encode(const uint8_t *rgb, const Box &box, uint8_t *pixelData) const;
+   Box alignBox(Box box) const;
+   size_t getFrameLength() const;
+
+   void processFrame(int slot, uint64_t sequence);
+   void onFrameReturned(int slot);
+
+private:
+   SyntheticScene scene;
+   FrameFormat format;
+
+   // each background as RGB, and encoded in our pixel format
+   std::vector<uint8_t> backgroundRGB[BackgroundCount];
+   std::vector<uint8_t> backgroundPixels[BackgroundCount];
+
+   // where the dot gets drawn before it's encoded
+   std::vector<uint8_t> scratchRGB;
+
+   std::function<void(const std::shared_ptr<VideoFrame> &)> frameCallback;
+   std::thread renderThread;
+   std::atomic<bool> terminated { false };
+   std::atomic<uint64_t> framesSkipped { 0 };
+
+   // frames in the pool are busy from when we start drawing them until
+   // they're returned or dropped; the pool gets leaked if one never is
+   std::unique_ptr<std::atomic<bool>[]> frameBusy;
+   std::unique_ptr<FramePool> framePool { new FramePool([this](int slot) { onFrameReturned(slot); }) };
+   std::unique_ptr<FrameDispatcher> frameDispatcher;
+};
+
+
+#endif
@@ -6,11 +6,107 @@
  */
 
 #include <iostream>
+#include <time.h>
 #include <sys/mman.h>
 #include "VideoFrame.h"
 
 
 
+// =====================================================
+//  struct FrameFormat
+// =====================================================
+
+/// <summary>
+/// Creates a format with rows of the given stride, or packed tight if it's
+/// zero, and planes one after the other
+/// </summary>
+FrameFormat FrameFormat::create(PixelFormat pixelFormat, int width, int height, int stride)
+{
+	FrameFormat format;
+	format.pixelFormat = pixelFormat;
+	format.width = width;
+	format.height = height;
+	if (stride <= 0)
+		stride = getMinimumStride(pixelFormat, width);
+	format.planeStride[0] = stride;
+
+	if (pixelFormat == PixelFormat::YUV420)
+	{
+		format.planeCount = 3;
+		format.planeOffset[1] = stride * height;
+		format.planeStride[1] = stride / 2;
+		format.planeOffset[2] = format.planeOffset[1] + (stride / 2) * (height / 2);
+		format.planeStride[2] = stride / 2;
+	}
+	return format;
+}
+
+
+/// <summary>
+/// Returns the length of an unpadded row of the first plane
+/// </summary>
+int FrameFormat::getMinimumStride(PixelFormat pixelFormat, int width)
+{
+	switch (pixelFormat)
+	{
+	case PixelFormat::BGR24:
+	case PixelFormat::RGB24:
+		return 3 * width;
+	case PixelFormat::XRGB8888:
+		return 4 * width;
+	case PixelFormat::YUV420:
+		return width;
+	case PixelFormat::BayerRGGB10:
+	case PixelFormat::BayerGRBG10:
+	case PixelFormat::BayerGBRG10:
+	case PixelFormat::BayerBGGR10:
+		return 2 * width;
+	default:
+		return 5 * width / 4;
+	}
+}
+
+
+/// <summary>
+/// Returns how many rows of the frame are actually present in a buffer of
+/// the given length; normally that's the height, but a short buffer means
+/// a short frame.  Bayer frames only count whole 2x2 cells.
+/// </summary>
+int FrameFormat::getRowsAvailable(int pixelDataLength) const
+{
+	int rows = height;
+	for (int plane=0; plane<planeCount; ++plane)
+	{
+		if (planeStride[plane] <= 0 || pixelDataLength < planeOffset[plane])
+			return 0;
+
+		// the chroma planes of YUV420 are half height
+		int scale = (plane == 0) ? 1 : 2;
+		int planeRows = scale * ((pixelDataLength - planeOffset[plane]) / planeStride[plane]);
+		if (planeRows < rows)
+			rows = planeRows;
+	}
+
+	if (isBayer(pixelFormat))
+		rows &= ~1;
+	return rows;
+}
+
+
+/// <summary>
+/// Formats are the same if they lay out pixels the same way
+/// </summary>
+bool FrameFormat::operator==(const FrameFormat &other) const
+{
+	if (pixelFormat != other.pixelFormat || width != other.width || height != other.height || planeCount != other.planeCount)
+		return false;
+	for (int plane=0; plane<planeCount; ++plane)
+		if (planeOffset[plane] != other.planeOffset[plane] || planeStride[plane] != other.planeStride[plane])
+			return false;
+	return true;
+}
+
+
 // =====================================================
 //  class VideoFrame
 // =====================================================
@@ -24,21 +120,61 @@ VideoFrame::~VideoFrame()
 }
 
 /// <summary>
-/// Packages it up as a string for the benefit of text-based streams
+/// Returns the current time by the same clock as frame timestamps
+/// </summary>
+uint64_t VideoFrame::getCurrentTimestamp()
+{
+   struct timespec now;
+   clock_gettime(CLOCK_BOOTTIME, &now);
+   return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/// <summary>
+/// Packages it up as a string for the benefit of text-based streams; rows
+/// are sent without their padding, so that the far end only needs to know
+/// the width and height
 /// </summary>
 std::string VideoFrame::toString() const
 {
    static char HEX_DIGITS[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
 
-	std::string result;
-
 	int count = getPixelDataLength();
 	const uint8_t *p = getPixelData();
-	for (int i=0; i<count; ++i)
+
+	// work out the rows we're sending; if we don't know the layout we just
+	// send the whole buffer as one long row
+	int planeRows[FrameFormat::MaxPlanes] = { 1 };
+	int planeRowLength[FrameFormat::MaxPlanes] = { count };
+	int total = count;
+	if (format.width > 0)
+	{
+		int rows = format.getRowsAvailable(count);
+		total = 0;
+		for (int plane=0; plane<format.planeCount; ++plane)
+		{
+			int minimumStride = FrameFormat::getMinimumStride(format.pixelFormat, format.width);
+			planeRows[plane] = (plane == 0) ? rows : rows / 2;
+			planeRowLength[plane] = (plane == 0) ? minimumStride : minimumStride / 2;
+			total += planeRows[plane] * planeRowLength[plane];
+		}
+	}
+
+	// size it once rather than letting it grow a couple of megabytes one
+	// character at a time
+	std::string result(2 * total, '0');
+	int i = 0;
+	for (int plane=0; plane<format.planeCount; ++plane)
 	{
-      uint8_t b = p[i];
-		result += HEX_DIGITS[(b>>4)];
-		result += HEX_DIGITS[(b&0xF)];
+		for (int row=0; row<planeRows[plane]; ++row)
+		{
+			const uint8_t *rowData = (format.width > 0) ? p + format.planeOffset[plane] + format.planeStride[plane] * row : p;
+			for (int column=0; column<planeRowLength[plane]; ++column)
+			{
+				uint8_t b = rowData[column];
+				result[i++] = HEX_DIGITS[(b>>4)];
+				result[i++] = HEX_DIGITS[(b&0xF)];
+			}
+		}
 	}
 	return result;
 }
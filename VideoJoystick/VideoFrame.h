@@ -8,10 +8,68 @@
 #ifndef VIDEOFRAME_H_
 #define VIDEOFRAME_H_
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 
 
+/// <summary>
+/// Pixel layouts that we know how to process; the names describe the order
+/// of the bytes in memory, i.e. BGR24 is a byte of blue, then green, then red.
+/// XRGB8888 is 32-bit little-endian, so the bytes are B, G, R, X.  YUV420 is
+/// planar: a full resolution Y plane followed by quarter resolution U and V
+/// planes.
+///
+/// The Bayer formats are raw sensor output, named by the colors of the top
+/// left 2x2 cell of photosites.  Unpacked 10-bit samples are 16-bit little-
+/// endian; packed ones use the MIPI CSI-2 layout, in which each group of 4
+/// samples is 4 bytes of their high 8 bits followed by a byte of their low
+/// 2 bits.
+/// </summary>
+enum class PixelFormat {
+	BGR24,
+	RGB24,
+	XRGB8888,
+	YUV420,
+	BayerRGGB10,
+	BayerGRBG10,
+	BayerGBRG10,
+	BayerBGGR10,
+	BayerRGGB10Packed,
+	BayerGRBG10Packed,
+	BayerGBRG10Packed,
+	BayerBGGR10Packed
+};
+
+inline bool isBayer(PixelFormat format) { return format >= PixelFormat::BayerRGGB10; }
+inline bool isPackedRGB(PixelFormat format) { return format == PixelFormat::BGR24 || format == PixelFormat::RGB24 || format == PixelFormat::XRGB8888; }
+
+
+/// <summary>
+/// Describes how the pixels of a frame are laid out in its buffer.  YUV420
+/// has a plane for each of Y, U and V, everything else has just the one.
+/// Rows may be padded, so always go by the stride rather than the width.
+/// </summary>
+struct FrameFormat {
+	static constexpr int MaxPlanes = 3;
+
+	PixelFormat pixelFormat = PixelFormat::BGR24;
+	int width = 0;
+	int height = 0;
+	int planeCount = 1;
+	int planeOffset[MaxPlanes] = {};
+	int planeStride[MaxPlanes] = {};
+
+	static FrameFormat create(PixelFormat pixelFormat, int width, int height, int stride = 0);
+	static int getMinimumStride(PixelFormat pixelFormat, int width);
+
+	int getRowsAvailable(int pixelDataLength) const;
+
+	bool operator==(const FrameFormat &other) const;
+	bool operator!=(const FrameFormat &other) const { return !(*this == other); }
+};
+
+
 class VideoFrame {
 public:
    VideoFrame();
@@ -20,7 +78,44 @@ public:
 	virtual int getPixelDataLength() const = 0;
 	virtual const uint8_t *getPixelData() const = 0;
 
+	// the frame grabber has to tell us how its pixels are laid out; until
+	// then the frame is 0x0
+	const FrameFormat &getFormat() const { return format; }
+	void setFormat(const FrameFormat &format) { this->format = format; }
+	PixelFormat getPixelFormat() const { return format.pixelFormat; }
+
+	// the order in which the frame grabber delivered the frame
+	uint64_t getSequence() const { return sequence; }
+	void setSequence(uint64_t sequence) { this->sequence = sequence; }
+
+	// the camera's own number for the frame, which counts every frame the
+	// sensor produced; gaps are frames we never saw
+	uint64_t getCameraSequence() const { return cameraSequence; }
+	void setCameraSequence(uint64_t sequence) { this->cameraSequence = sequence; }
+
+	// when the frame was exposed, in nanoseconds by CLOCK_BOOTTIME (the clock
+	// libcamera stamps frames with), so that it can be compared with
+	// getCurrentTimestamp; zero if the frame grabber doesn't know
+	uint64_t getTimestamp() const { return timestamp; }
+	void setTimestamp(uint64_t timestamp) { this->timestamp = timestamp; }
+	static uint64_t getCurrentTimestamp();
+
+	// by the same clock, when the camera handed the frame to the frame
+	// grabber and when the frame grabber handed it to a processing thread
+	uint64_t getCompletionTimestamp() const { return completionTimestamp; }
+	void setCompletionTimestamp(uint64_t timestamp) { this->completionTimestamp = timestamp; }
+	uint64_t getHandoffTimestamp() const { return handoffTimestamp; }
+	void setHandoffTimestamp(uint64_t timestamp) { this->handoffTimestamp = timestamp; }
+
 	std::string toString(void) const;
+
+private:
+	FrameFormat format;
+	uint64_t sequence = 0;
+	uint64_t cameraSequence = 0;
+	uint64_t timestamp = 0;
+	uint64_t completionTimestamp = 0;
+	uint64_t handoffTimestamp = 0;
 };
 
 
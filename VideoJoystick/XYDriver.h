@@ -46,10 +46,11 @@ public:
    void cal10() { config.xy10 = getStablePixelXY(); }
    void cal11() { config.xy11 = getStablePixelXY(); }
 
+   static void decompose(XY vin, XY va, XY vb, float *aMagnitude, float *bMagnitude);
+
 private:
    XY clip(XY xy);
-   void decompose(XY vin, XY va, XY vb, float *aMagnitude, float *bMagnitude);
-   float determinant(float a1, float a2, float b1, float b2);
+   static float determinant(float a1, float a2, float b1, float b2);
    XY getStablePixelXY();
 
 private:
@@ -4,6 +4,8 @@
 // Warantee: none, your own risk
 //
 
+#include <cctype>
+#include <cmath>
 #include <csignal>
 #include <iostream>
 #include <stdexcept>
@@ -11,11 +13,16 @@
 #include "LibCamera/LibCameraFrameGrabber.h"
 
 // project includes
+#include "AllocationCounter.h"
 #include "CommandProcessor.h"
+#include "FileFrameGrabber.h"
 #include "FrameHandler.h"
+#include "FrameRecorder.h"
 #include "LedControl.h"
 #include "SocketListener.h"
 #include "SPIDAC.h"
+#include "Statistics.h"
+#include "SyntheticFrameGrabber.h"
 #include "VJConfig.h"
 #include "XYDriver.h"
 
@@ -48,6 +55,70 @@ static void signal_handler(int signal_number)
  */
 int main(int argc, const char **argv)
 {
+   // "--pipeline N" lets us process up to N consecutive frames at once on
+   // different threads; "--yuv" has the camera give us YUV420, of which we
+   // mostly read just the V plane, and "--raw" gets us the sensor's Bayer
+   // output without going through the ISP.  "--queue" says what happens to
+   // frames that arrive while the processing threads are busy: "latest" keeps
+   // only the newest, "bounded N" keeps up to N in order and "inline" does
+   // the processing on the camera's own thread.
+   //
+   // "--record FILE" writes every frame we get to a capture file, and
+   // "--replay FILE" plays one back instead of using the camera, at the pace
+   // it was recorded or, with "--fast", as fast as we can take it.
+   // "--synthetic [FPS]" renders a moving dot instead, in whatever format
+   // was asked for, and keeps track of how far off we are.
+   int pipelineDepth = 1;
+   PixelFormat pixelFormat = PixelFormat::BGR24;
+   FrameDispatcher::Settings dispatchSettings;
+   std::filesystem::path recordPath;
+   std::filesystem::path replayPath;
+   FileFrameGrabber::Pacing replayPacing = FileFrameGrabber::Pacing::Recorded;
+   bool synthetic = false;
+   SyntheticScene syntheticScene;
+   for (int i=1; i<argc; ++i)
+   {
+      if (std::string(argv[i]) == "--pipeline" && i + 1 < argc)
+         pipelineDepth = atoi(argv[++i]);
+      else if (std::string(argv[i]) == "--record" && i + 1 < argc)
+         recordPath = argv[++i];
+      else if (std::string(argv[i]) == "--replay" && i + 1 < argc)
+         replayPath = argv[++i];
+      else if (std::string(argv[i]) == "--fast")
+         replayPacing = FileFrameGrabber::Pacing::AsFastAsPossible;
+      else if (std::string(argv[i]) == "--synthetic")
+      {
+         synthetic = true;
+         if (i + 1 < argc && isdigit(argv[i + 1][0]))
+            syntheticScene.frameRate = atof(argv[++i]);
+      }
+      else if (std::string(argv[i]) == "--queue" && i + 1 < argc)
+      {
+         std::string policy = argv[++i];
+         if (policy == "latest")
+            dispatchSettings.policy = FrameDispatcher::Policy::LatestWins;
+         else if (policy == "inline")
+            dispatchSettings.policy = FrameDispatcher::Policy::Inline;
+         else if (policy == "bounded")
+         {
+            dispatchSettings.policy = FrameDispatcher::Policy::Bounded;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+               dispatchSettings.queueDepth = atoi(argv[++i]);
+         }
+         else
+         {
+            std::cerr << "unknown queue policy: " << policy << std::endl;
+            return 1;
+         }
+      }
+      else if (std::string(argv[i]) == "--yuv")
+         pixelFormat = PixelFormat::YUV420;
+      else if (std::string(argv[i]) == "--raw")
+         pixelFormat = PixelFormat::BayerRGGB10Packed;   // the sensor decides the actual order
+   }
+
+   dispatchSettings.threadCount = pipelineDepth;
+
    // load our config
    VJConfig config(CONFIG_FILE_PATH);
 
@@ -94,7 +165,7 @@ int main(int argc, const char **argv)
 
    // FrameHandler is where the fun begins... it turns incoming frames into
    // pixel locations of the red dot
-   FrameHandler frameHandler;
+   FrameHandler frameHandler(0, pipelineDepth);
    commander.AddHandler("getImage", [&](std::string)
    {
       return frameHandler.GetImageAsString();
@@ -105,6 +176,139 @@ int main(int argc, const char **argv)
    });
    commander.AddHandler("getSaturation", [&frameHandler](std::string){ return std::to_string(frameHandler.getSaturiationPercent()); });
    commander.AddHandler("getFrameProcessTime", [&frameHandler](std::string){ return std::to_string(frameHandler.getFrameProcessTime().count()); });
+   commander.AddHandler("getOutputLatency", [&frameHandler](std::string){ return std::to_string(frameHandler.getOutputLatency().count()); });
+   commander.AddHandler("getLatency", [&frameHandler](std::string){ return frameHandler.getLatency().toString(); });
+   commander.AddHandler("resetLatency", [&frameHandler](std::string)
+   {
+      frameHandler.getLatency().reset();
+      return std::string();
+   });
+   commander.AddHandler("getAllocations", [&frameHandler](std::string)
+   {
+      // only meaningful in builds with VJ_COUNT_ALLOCATIONS defined
+      if (!AllocationCounter::isEnabled())
+         return std::string("disabled");
+      return
+         std::to_string(frameHandler.getFrameAllocations()) + "," +
+         std::to_string(frameHandler.getMaxFrameAllocations()) + "," +
+         std::to_string(AllocationCounter::getProcessAllocations());
+   });
+   commander.AddHandler("resetAllocations", [&frameHandler](std::string)
+   {
+      frameHandler.resetMaxFrameAllocations();
+      return std::string();
+   });
+   commander.AddHandler("getStripeCount", [&frameHandler](std::string){ return std::to_string(frameHandler.getStripeCount()); });
+   commander.AddHandler("getTrackingMode", [&frameHandler](std::string)
+   {
+      return std::string(frameHandler.getTrackingMode() == FrameHandler::TrackingMode::Tracking ? "Tracking" : "Acquiring");
+   });
+   commander.AddHandler("getWindowSize", [&frameHandler](std::string){ return std::to_string(frameHandler.getWindowSize()); });
+   commander.AddHandler("setWindowSize", [&frameHandler](std::string param)
+   {
+      frameHandler.setWindowSize(atoi(param.c_str()));
+      return std::string();
+   });
+   commander.AddHandler("getLossTimeout", [&frameHandler](std::string){ return std::to_string(frameHandler.getLossTimeout()); });
+   commander.AddHandler("setLossTimeout", [&frameHandler](std::string param)
+   {
+      frameHandler.setLossTimeout(atoi(param.c_str()));
+      return std::string();
+   });
+   commander.AddHandler("getSearchMode", [&frameHandler](std::string)
+   {
+      switch (frameHandler.getSearchMode())
+      {
+      case FrameHandler::SearchMode::Pyramid:
+         return "pyramid " + std::to_string(frameHandler.getPyramidBlockSize());
+      case FrameHandler::SearchMode::Profile:
+         return std::string("profile");
+      default:
+         return std::string("dense");
+      }
+   });
+   commander.AddHandler("setSearchMode", [&frameHandler](std::string param)
+   {
+      // "dense", "profile", or "pyramid" with an optional block size of 4 or 8
+      if (param.compare(0, 7, "pyramid") == 0)
+      {
+         if (param.size() > 8)
+            frameHandler.setPyramidBlockSize(atoi(param.c_str() + 8));
+         frameHandler.setSearchMode(FrameHandler::SearchMode::Pyramid);
+      }
+      else if (param == "dense")
+         frameHandler.setSearchMode(FrameHandler::SearchMode::Dense);
+      else if (param == "profile")
+         frameHandler.setSearchMode(FrameHandler::SearchMode::Profile);
+      else
+         return std::string("Invalid search mode: \"") + param + "\"";
+      return std::string();
+   });
+   commander.AddHandler("getDotSelection", [&frameHandler](std::string)
+   {
+      switch (frameHandler.getDotSelection())
+      {
+      case FrameHandler::DotSelection::LargestBlob:
+         return std::string("largest");
+      case FrameHandler::DotSelection::ClosestBlob:
+         return std::string("closest");
+      case FrameHandler::DotSelection::BrightestBlob:
+         return std::string("brightest");
+      default:
+         return std::string("median");
+      }
+   });
+   commander.AddHandler("setDotSelection", [&frameHandler](std::string param)
+   {
+      // "median" for all the hits, or "largest", "closest" or "brightest" blob
+      if (param == "median")
+         frameHandler.setDotSelection(FrameHandler::DotSelection::Median);
+      else if (param == "largest")
+         frameHandler.setDotSelection(FrameHandler::DotSelection::LargestBlob);
+      else if (param == "closest")
+         frameHandler.setDotSelection(FrameHandler::DotSelection::ClosestBlob);
+      else if (param == "brightest")
+         frameHandler.setDotSelection(FrameHandler::DotSelection::BrightestBlob);
+      else
+         return std::string("Invalid dot selection: \"") + param + "\"";
+      return std::string();
+   });
+   commander.AddHandler("getLumaCheck", [&frameHandler](std::string){ return std::to_string(frameHandler.getLumaCheck() ? 1 : 0); });
+   commander.AddHandler("setLumaCheck", [&frameHandler](std::string param)
+   {
+      frameHandler.setLumaCheck(atoi(param.c_str()) != 0);
+      return std::string();
+   });
+   commander.AddHandler("getBackgroundModel", [&frameHandler](std::string){ return std::to_string(frameHandler.getBackgroundModel() ? 1 : 0); });
+   commander.AddHandler("setBackgroundModel", [&frameHandler](std::string param)
+   {
+      frameHandler.setBackgroundModel(atoi(param.c_str()) != 0);
+      return std::string();
+   });
+   commander.AddHandler("getColorTable", [&frameHandler](std::string)
+   {
+      std::shared_ptr<const ColorTable> table = frameHandler.getColorTable();
+      if (!table)
+         return std::string("rule");
+      return "table " + std::to_string(table->getDotEntries());
+   });
+   commander.AddHandler("setColorTable", [&frameHandler](std::string param)
+   {
+      // "rule" for the vectorized r > g + b, "default" for the table of it
+      if (param == "rule")
+         frameHandler.setColorTable(nullptr);
+      else if (param == "default")
+         frameHandler.setColorTable(frameHandler.getDefaultColorTable());
+      else
+         return std::string("Invalid color table: \"") + param + "\"";
+      return std::string();
+   });
+   commander.AddHandler("trainColorTable", [&frameHandler](std::string param)
+   {
+      // the radius of the dot in pixels, if it isn't the usual
+      float radius = param.empty() ? 6.0f : (float)atof(param.c_str());
+      return frameHandler.trainColorTable(radius);
+   });
 
    // ============================================================
    // Initialize XYDriver
@@ -114,10 +318,42 @@ int main(int argc, const char **argv)
    // ============================================================
    XYDriver xyDriver;
    xyDriver.setConfig(config.getXYDriverConfig());
-   frameHandler.setFrameNotify([&](int pixelX,  int pixelY){
+
+   // with synthetic frames we know where the dot really is, so we keep track
+   // of how far off we are, in thousandths of a pixel
+   SyntheticFrameGrabber *syntheticGrabber = nullptr;
+   std::atomic<uint64_t> truthCount { 0 };
+   std::atomic<uint64_t> truthErrorSum { 0 };
+   std::atomic<uint64_t> truthErrorMax { 0 };
+   commander.AddHandler("getTruthError", [&](std::string)
+   {
+      uint64_t count = truthCount;
+      if (count == 0)
+         return std::string();
+      return
+         std::to_string(count) + "," +
+         std::to_string(truthErrorSum / count / 1000.0) + "," +
+         std::to_string(truthErrorMax / 1000.0);
+   });
+
+   frameHandler.setFrameNotify([&](float pixelX, float pixelY, const VideoFrame &frame){
+      if (syntheticGrabber != nullptr)
+      {
+         float trueX, trueY;
+         syntheticGrabber->getDotPosition(frame.getCameraSequence(), trueX, trueY);
+         uint64_t error = (uint64_t)std::lround(1000 * std::hypot(pixelX - trueX, pixelY - trueY));
+         ++truthCount;
+         truthErrorSum += error;
+         uint64_t max = truthErrorMax;
+         while (error > max && !truthErrorMax.compare_exchange_weak(max, error))
+            ;
+      }
+
       XY xy = xyDriver.getXY(XY(pixelX, pixelY));
+      frameHandler.getLatency().record(LatencyStage::Transform, frame);
       spiDac.sendX(xy.x);
       spiDac.sendY(xy.y);
+      frameHandler.getLatency().record(LatencyStage::Output, frame);
    });
    commander.AddHandler("getXY", [&](std::string) {
       XY xy = xyDriver.getXY(XY(frameHandler.getX(), frameHandler.getY()), true);
@@ -145,6 +381,49 @@ int main(int argc, const char **argv)
       });
 
 
+   // the recorder is declared ahead of the frame grabber so that it outlives
+   // it; the grabber's callback uses it until the grabber is destroyed
+   std::unique_ptr<FrameRecorder> frameRecorder;
+
+   // the frame grabber doesn't exist until we start capturing
+   std::unique_ptr<FrameGrabber> frameGrabber;
+   commander.AddHandler("getFrameCounts", [&](std::string)
+   {
+      if (!frameGrabber)
+         return std::string();
+      return
+         std::to_string(frameGrabber->getFramesProcessed()) + "," +
+         std::to_string(frameGrabber->getFramesDropped()) + "," +
+         std::to_string(frameHandler.getFramesDeliveredLate()) + "," +
+         std::to_string(frameHandler.getFramesMissed());
+   });
+   commander.AddHandler("getStats", [](std::string){ return Statistics::getInstance()->toString(); });
+   commander.AddHandler("getFramePool", [&](std::string)
+   {
+      if (!frameGrabber)
+         return std::string();
+      return
+         std::to_string(frameGrabber->getFramesHeld()) + "," +
+         std::to_string(frameGrabber->getMaxFramesHeld()) + "," +
+         std::to_string(frameGrabber->getTimesPoolExhausted());
+   });
+   commander.AddHandler("getQueue", [&](std::string)
+   {
+      if (!frameGrabber)
+         return std::string();
+      return
+         frameGrabber->getQueuePolicy() + "," +
+         std::to_string(frameGrabber->getQueueDepth()) + "," +
+         std::to_string(frameGrabber->getMaxQueueDepth()) + "," +
+         std::to_string(frameGrabber->getFramesDropped());
+   });
+   commander.AddHandler("resetQueue", [&](std::string)
+   {
+      if (frameGrabber)
+         frameGrabber->resetMaxQueueDepth();
+      return std::string();
+   });
+
    std::signal(SIGINT, signal_handler);
    std::signal(SIGTERM, signal_handler);
    std::signal(SIGKILL, signal_handler);
@@ -154,11 +433,31 @@ int main(int argc, const char **argv)
 
    try
    {
-      std::unique_ptr<FrameGrabber> frameGrabber(LibCameraFrameGrabber::createUniqueCamera());
+      if (!replayPath.empty())
+      {
+         // recorded frames are past the camera's warmup already
+         frameGrabber.reset(new FileFrameGrabber(replayPath, replayPacing));
+         frameHandler.setWarmupFrames(0);
+      }
+      else if (synthetic)
+      {
+         syntheticScene.pixelFormat = pixelFormat;
+         syntheticGrabber = new SyntheticFrameGrabber(syntheticScene, dispatchSettings);
+         frameGrabber.reset(syntheticGrabber);
+         frameHandler.setWarmupFrames(0);
+      }
+      else
+         frameGrabber.reset(LibCameraFrameGrabber::createUniqueCamera(dispatchSettings, pixelFormat));
+
+      if (!recordPath.empty())
+         frameRecorder.reset(new FrameRecorder(recordPath));
 
       // Enable the camera video port and tell it its callback function
       frameGrabber->SetupFrameCallback([&](const std::shared_ptr<VideoFrame> &frame)
       {
+         if (frameRecorder)
+            frameRecorder->record(*frame);
+
          // process it
          frameHandler.HandleFrame(frame);
       });
@@ -166,10 +465,11 @@ int main(int argc, const char **argv)
       // start grabbing frames
       frameGrabber->startCapturing();
 
-      // watch for signal to exit
-      while (!signalStatus)
+      // watch for signal to exit, and keep the statistics' rates up to date
+      while (!signalStatus && !frameGrabber->isFinished())
       {
          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+         Statistics::getInstance()->sample();
       }
    }
    catch (std::exception &e)